@@ -1,12 +1,478 @@
+/*
+ * Reading videos
+ * A video is a sequence of images (frames), so we read it frame by frame with cv::VideoCapture and show every frame
+ * for a moment with imshow() and waitKey().
+ *
+ * Threaded capture
+ * In the simple loop cap.read() and the processing of the frame run on the same thread, so the time to decode a frame
+ * and the time to process it add up. With --threaded the frames are decoded on a separate thread by ThreadedCapture
+ * (see common/ThreadedCapture.h) into a small ring of reused buffers, and the loop below only takes the next
+ * decoded frame out of the ring and gives the buffer back when it's done with it. --policy decides what happens when
+ * the loop is slower than the decoder: block waits, drop-oldest, drop-newest and latest-only throw frames away. At
+ * the end we print how many frames were decoded and dropped and how full the ring got.
+ *
+ * Headless benchmark
+ * The loop above is paced by waitKey(20), so it always runs at about 50 frames per second, whatever the machine can
+ * do. --bench reads the video as fast as possible, without any window, and reports:
+ *	- decode frames per second,
+ *	- the latency percentiles (p50, p95, p99) of reading a frame and of reading plus processing it,
+ *	- the resident memory (RSS) of the process, once per second while it runs.
+ * --stage runs a processing step on every frame: gray (cvtColor), blur (gray + GaussianBlur) or canny (gray + blur +
+ * Canny). The numbers tell us how many streams one machine can handle.
+ *
+ * Decoding a file on all cores
+ * A VideoCapture decodes one frame after the other, on one core. But a video can be decoded starting at any
+ * keyframe, so --segments splits the file at keyframes into segments and lets several workers decode them at the same
+ * time, each with its own VideoCapture. The result of every frame (here the mean of the --stage output) is stored
+ * with the frame's presentation timestamp (CAP_PROP_POS_MSEC), and the results of all workers are merged in timestamp
+ * order. With B-frames the order of the packets (which the segments are cut by) differs from the order the frames
+ * are shown in, so merging by frame number would only be right for streams without them. The keyframes are
+ * found in a first pass that only reads the packets without decoding them, and are cached next to the video in
+ * <video>.keyframes, so later runs can start right away. --verify decodes the file once more in one pass and checks
+ * that every frame gives the same result at the same timestamp.
+ *
+ * Usage:
+ *	Source [video]                                         (default: ../vid/driving_car.mp4)
+ *	Source --threaded [video] [--buffers N] [--policy block|drop-oldest|drop-newest|latest-only]
+ *	Source --bench [video] [--stage none|gray|blur|canny]
+ *	Source --segments [video] [--workers N] [--stage none|gray|blur|canny] [--verify]
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
 #include <opencv2/opencv.hpp>
+#include "../common/Percentile.h"
+#include "../common/ThreadedCapture.h"
 
-int main()
+#ifdef _WIN32
+// Without NOMINMAX windows.h defines min and max macros, which break std::min and std::max.
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+// Resident memory of this process in megabytes, or -1 if we can't tell.
+double residentMegabytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return -1;
+	return counters.WorkingSetSize / (1024.0 * 1024.0);
+#else
+	// The second number in /proc/self/statm is the resident size in pages.
+	std::FILE* file{ std::fopen("/proc/self/statm", "r") };
+	if (!file)
+		return -1;
+	long size{ 0 }, resident{ 0 };
+	int read{ std::fscanf(file, "%ld %ld", &size, &resident) };
+	std::fclose(file);
+	if (read != 2)
+		return -1;
+	return resident * static_cast<double>(sysconf(_SC_PAGESIZE)) / (1024.0 * 1024.0);
+#endif
+}
+
+// The optional processing step run on every frame, with its buffers reused from frame to frame.
+struct FrameStage
+{
+	std::string name{ "none" };
+	cv::Mat gray, blurred, edges;
+
+	static bool valid(const std::string& stage)
+	{
+		return stage == "none" || stage == "gray" || stage == "blur" || stage == "canny";
+	}
+
+	// Runs the stage and returns its output (the frame itself for "none").
+	const cv::Mat& apply(const cv::Mat& img)
+	{
+		if (name == "none")
+			return img;
+		cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+		if (name == "gray")
+			return gray;
+		cv::GaussianBlur(gray, blurred, cv::Size(7, 7), 0);
+		if (name == "blur")
+			return blurred;
+		cv::Canny(blurred, edges, 50, 150);
+		return edges;
+	}
+};
+
+int runBenchmark(int argc, char** argv)
+{
+	std::string videoPath{ "../vid/driving_car.mp4" };
+	FrameStage stage;
+	for (int i{ 2 }; i < argc; ++i)
+	{
+		std::string arg{ argv[i] };
+		if (arg == "--stage" && i + 1 < argc)
+			stage.name = argv[++i];
+		else
+			videoPath = arg;
+	}
+	if (!FrameStage::valid(stage.name))
+	{
+		std::cerr << "Unknown stage " << stage.name << ", use none, gray, blur or canny\n";
+		return 1;
+	}
+
+	cv::VideoCapture cap{ videoPath };
+	if (!cap.isOpened())
+	{
+		std::cerr << "Cannot open " << videoPath << '\n';
+		return 1;
+	}
+
+	using Clock = std::chrono::steady_clock;
+	cv::Mat img;
+	std::vector<double> readMs, frameMs;
+	auto begin{ Clock::now() };
+	auto nextReport{ begin + std::chrono::seconds(1) };
+	std::cout << std::fixed << std::setprecision(2);
+
+	while (true)
+	{
+		auto start{ Clock::now() };
+		cap.read(img);
+		if (img.empty())
+			break;
+		auto decoded{ Clock::now() };
+
+		stage.apply(img);
+		auto end{ Clock::now() };
+
+		readMs.push_back(std::chrono::duration<double, std::milli>(decoded - start).count());
+		frameMs.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+
+		if (end >= nextReport)
+		{
+			std::cout << "t = " << std::chrono::duration<double>(end - begin).count() << " s, frames: "
+				<< readMs.size() << ", RSS: " << residentMegabytes() << " MB\n";
+			nextReport += std::chrono::seconds(1);
+		}
+	}
+
+	double seconds{ std::chrono::duration<double>(Clock::now() - begin).count() };
+	if (readMs.empty())
+	{
+		std::cerr << "No frames in " << videoPath << '\n';
+		return 1;
+	}
+
+	double readTotal{ 0 };
+	for (double ms : readMs)
+		readTotal += ms;
+	std::sort(readMs.begin(), readMs.end());
+	std::sort(frameMs.begin(), frameMs.end());
+
+	std::cout << "Frames: " << readMs.size() << " (" << img.cols << "x" << img.rows << ") in " << seconds << " s\n";
+	std::cout << "Decode fps: " << readMs.size() / (readTotal / 1000.0) << ", overall fps with stage '" << stage.name
+		<< "': " << readMs.size() / seconds << '\n';
+	std::cout << "Read latency   p50/p95/p99: " << percentile(readMs, 50) << " / " << percentile(readMs, 95) << " / "
+		<< percentile(readMs, 99) << " ms\n";
+	std::cout << "Frame latency  p50/p95/p99: " << percentile(frameMs, 50) << " / " << percentile(frameMs, 95)
+		<< " / " << percentile(frameMs, 99) << " ms\n";
+	std::cout << "Final RSS: " << residentMegabytes() << " MB\n";
+
+	return 0;
+}
+
+// Frames of a video file and the frames that start with a keyframe. Decoding can start at a keyframe without
+// anything from before it.
+struct KeyframeIndex
+{
+	std::int64_t frames{ 0 };
+	std::vector<std::int64_t> keyframes;
+};
+
+// Size and modification time of the video, stored in the cache so a changed file gets a new index.
+std::string videoSignature(const std::filesystem::path& path)
+{
+	std::error_code error;
+	auto size{ std::filesystem::file_size(path, error) };
+	auto time{ std::filesystem::last_write_time(path, error).time_since_epoch().count() };
+	return std::to_string(size) + " " + std::to_string(time);
+}
+
+bool loadKeyframeIndex(const std::filesystem::path& cachePath, const std::string& signature, KeyframeIndex& index)
+{
+	std::ifstream in{ cachePath };
+	std::string line;
+	if (!std::getline(in, line) || line != signature)
+		return false;
+	if (!(in >> index.frames))
+		return false;
+	index.keyframes.clear();
+	std::int64_t keyframe{ 0 };
+	while (in >> keyframe)
+		index.keyframes.push_back(keyframe);
+	return index.frames > 0 && !index.keyframes.empty();
+}
+
+void saveKeyframeIndex(const std::filesystem::path& cachePath, const std::string& signature, const KeyframeIndex& index)
+{
+	std::ofstream out{ cachePath };
+	out << signature << '\n' << index.frames << '\n';
+	for (std::int64_t keyframe : index.keyframes)
+		out << keyframe << '\n';
+}
+
+// Reads the whole file once without decoding it: with CAP_PROP_FORMAT = -1 the FFmpeg backend returns the encoded
+// packets, and CAP_PROP_LRF_HAS_KEY_FRAME tells whether the last one was a keyframe. That only needs the demuxer, so
+// it's much faster than decoding. Without support for it (older OpenCV or another backend) we fall back to evenly
+// spaced segment starts; seeking still lands on the exact frame, it just has to decode from the keyframe before it.
+KeyframeIndex buildKeyframeIndex(const std::string& videoPath, int fallbackSegments)
+{
+	KeyframeIndex index;
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && (CV_VERSION_MINOR > 5 || (CV_VERSION_MINOR == 5 && CV_VERSION_REVISION >= 4)))
+	cv::VideoCapture raw;
+	if (raw.open(videoPath, cv::CAP_FFMPEG, { cv::CAP_PROP_FORMAT, -1 }))
+	{
+		cv::Mat packet;
+		while (raw.read(packet))
+		{
+			if (raw.get(cv::CAP_PROP_LRF_HAS_KEY_FRAME) != 0)
+				index.keyframes.push_back(index.frames);
+			++index.frames;
+		}
+	}
+#endif
+	if (index.keyframes.empty())
+	{
+		cv::VideoCapture cap{ videoPath };
+		index.frames = static_cast<std::int64_t>(cap.get(cv::CAP_PROP_FRAME_COUNT));
+		for (int i{ 0 }; i < fallbackSegments; ++i)
+			index.keyframes.push_back(index.frames * i / fallbackSegments);
+	}
+	return index;
+}
+
+// The result of one frame and when it's shown.
+struct FrameResult
+{
+	double ms;
+	double value;
+};
+
+// Decodes the video on several threads at once. The file is split at keyframes into segments, and every worker
+// opens its own VideoCapture, seeks to the start of a segment and decodes it to the end. Each frame's result (the
+// mean of the stage output) is stored with its timestamp, and the results are sorted by timestamp at the end.
+int runSegments(int argc, char** argv)
+{
+	std::string videoPath{ "../vid/driving_car.mp4" };
+	FrameStage stage;
+	int workers{ static_cast<int>(std::max(1u, std::thread::hardware_concurrency())) };
+	bool verify{ false };
+	for (int i{ 2 }; i < argc; ++i)
+	{
+		std::string arg{ argv[i] };
+		if (arg == "--stage" && i + 1 < argc)
+			stage.name = argv[++i];
+		else if (arg == "--workers" && i + 1 < argc)
+			workers = std::max(1, std::stoi(argv[++i]));
+		else if (arg == "--verify")
+			verify = true;
+		else
+			videoPath = arg;
+	}
+	if (!FrameStage::valid(stage.name))
+	{
+		std::cerr << "Unknown stage " << stage.name << ", use none, gray, blur or canny\n";
+		return 1;
+	}
+
+	using Clock = std::chrono::steady_clock;
+	auto start{ Clock::now() };
+	std::filesystem::path cachePath{ videoPath + ".keyframes" };
+	std::string signature{ videoSignature(videoPath) };
+	KeyframeIndex index;
+	bool cached{ loadKeyframeIndex(cachePath, signature, index) };
+	if (!cached)
+	{
+		index = buildKeyframeIndex(videoPath, 4 * workers);
+		if (index.frames <= 0)
+		{
+			std::cerr << "Cannot read " << videoPath << '\n';
+			return 1;
+		}
+		saveKeyframeIndex(cachePath, signature, index);
+	}
+	double indexSeconds{ std::chrono::duration<double>(Clock::now() - start).count() };
+
+	// About four segments per worker, so a worker that finishes early takes another one. Segments always start at
+	// a keyframe.
+	std::vector<std::int64_t> starts;
+	std::size_t stride{ std::max<std::size_t>(1, index.keyframes.size() / (4 * workers)) };
+	for (std::size_t k{ 0 }; k < index.keyframes.size(); k += stride)
+		starts.push_back(index.keyframes[k]);
+	starts[0] = 0;
+	starts.push_back(index.frames);
+
+	std::vector<FrameResult> results(index.frames);
+	std::vector<uchar> done(index.frames, 0);
+	std::atomic<std::size_t> nextSegment{ 0 };
+
+	start = Clock::now();
+	std::vector<std::thread> threads;
+	for (int w{ 0 }; w < workers; ++w)
+	{
+		threads.emplace_back([&]
+			{
+				cv::VideoCapture cap{ videoPath };
+				FrameStage localStage;
+				localStage.name = stage.name;
+				cv::Mat img;
+				for (std::size_t s{ nextSegment++ }; s + 1 < starts.size(); s = nextSegment++)
+				{
+					cap.set(cv::CAP_PROP_POS_FRAMES, static_cast<double>(starts[s]));
+					for (std::int64_t f{ starts[s] }; f < starts[s + 1] && cap.read(img); ++f)
+					{
+						results[f] = { cap.get(cv::CAP_PROP_POS_MSEC), cv::mean(localStage.apply(img))[0] };
+						done[f] = 1;
+					}
+				}
+			});
+	}
+	for (auto& t : threads)
+		t.join();
+	double seconds{ std::chrono::duration<double>(Clock::now() - start).count() };
+
+	// Merge by presentation time. Frames the workers decoded in a different order than they are shown end up where
+	// they belong, frames decoded twice show up as equal timestamps.
+	std::vector<FrameResult> merged;
+	for (std::int64_t f{ 0 }; f < index.frames; ++f)
+	{
+		if (done[f])
+			merged.push_back(results[f]);
+	}
+	std::stable_sort(merged.begin(), merged.end(),
+		[](const FrameResult& a, const FrameResult& b) { return a.ms < b.ms; });
+	std::int64_t reordered{ 0 }, duplicates{ 0 };
+	for (std::size_t i{ 1 }; i < merged.size(); ++i)
+		duplicates += merged[i].ms == merged[i - 1].ms;
+	for (std::int64_t f{ 0 }, i{ 0 }; f < index.frames; ++f)
+	{
+		if (done[f])
+			reordered += results[f].ms != merged[i++].ms;
+	}
+
+	std::int64_t decoded{ static_cast<std::int64_t>(merged.size()) };
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "Keyframe index: " << index.keyframes.size() << " keyframes in " << index.frames << " frames, "
+		<< (cached ? "loaded from " : "built and saved to ") << cachePath.string() << " in " << indexSeconds << " s\n";
+	std::cout << "Segments: " << starts.size() - 1 << " on " << workers << " workers, decoded " << decoded
+		<< " frames in " << seconds << " s (" << decoded / seconds << " fps)\n";
+	std::cout << "Frames out of presentation order before merging: " << reordered << ", repeated timestamps: "
+		<< duplicates << '\n';
+
+	if (verify)
+	{
+		// Decode the whole file in one pass, which gives the frames in presentation order, and compare frame by frame.
+		cv::VideoCapture cap{ videoPath };
+		cv::Mat img;
+		std::int64_t mismatches{ 0 }, f{ 0 };
+		start = Clock::now();
+		for (; cap.read(img); ++f)
+		{
+			FrameResult expected{ cap.get(cv::CAP_PROP_POS_MSEC), cv::mean(stage.apply(img))[0] };
+			if (f >= decoded || merged[f].ms != expected.ms || merged[f].value != expected.value)
+				++mismatches;
+		}
+		if (f < decoded)
+			mismatches += decoded - f;
+		double sequential{ std::chrono::duration<double>(Clock::now() - start).count() };
+		std::cout << "Sequential: " << f << " frames in " << sequential << " s (" << sequential / seconds
+			<< "x slower), frames that differ: " << mismatches << '\n';
+	}
+
+	return 0;
+}
+
+int runThreaded(int argc, char** argv)
 {
+	std::string videoPath{ "../vid/driving_car.mp4" };
+	int buffers{ 4 };
+	DropPolicy policy{ DropPolicy::block };
+	for (int i{ 2 }; i < argc; ++i)
+	{
+		std::string arg{ argv[i] };
+		if (arg == "--buffers" && i + 1 < argc)
+			buffers = std::stoi(argv[++i]);
+		else if (arg == "--policy" && i + 1 < argc)
+		{
+			std::string name{ argv[++i] };
+			if (name == "block")
+				policy = DropPolicy::block;
+			else if (name == "drop-oldest")
+				policy = DropPolicy::dropOldest;
+			else if (name == "drop-newest")
+				policy = DropPolicy::dropNewest;
+			else if (name == "latest-only")
+				policy = DropPolicy::latestOnly;
+			else
+			{
+				std::cerr << "Unknown policy " << name << ", use block, drop-oldest, drop-newest or latest-only\n";
+				return 1;
+			}
+		}
+		else
+			videoPath = arg;
+	}
+
+	ThreadedCapture capture{ buffers, policy };
+	if (!capture.open(videoPath))
+	{
+		std::cerr << "Cannot open " << videoPath << '\n';
+		return 1;
+	}
+	capture.start();
+
+	// Every frame borrows a buffer of the ring, and gives it back at the end of the loop body.
+	while (CapturedFrame frame{ capture.next() })
+	{
+		cv::imshow("Frame", frame.image());
+		int key{ cv::waitKey(20) };
+		if (key == 'q')
+			break;
+	}
+
+	capture.stop();
+	cv::destroyAllWindows();
+
+	std::cout << "Decoded: " << capture.decoded() << ", dropped: " << capture.dropped() << ", ring: "
+		<< capture.capacity() << " buffers, at most " << capture.maxDepth() << " frames waiting\n";
+
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1 && std::string{ argv[1] } == "--threaded")
+		return runThreaded(argc, argv);
+	if (argc > 1 && std::string{ argv[1] } == "--bench")
+		return runBenchmark(argc, argv);
+	if (argc > 1 && std::string{ argv[1] } == "--segments")
+		return runSegments(argc, argv);
+
 	// Capture video
 	// Now, we have to capture the video, and we use the VideoCapture capture(videoPath) method of the OpenCV
 	// library. The videoPath stores the complete path of the video.
-	std::string videoPath{ "../vid/driving_car.mp4" };
+	std::string videoPath{ argc > 1 ? argv[1] : "../vid/driving_car.mp4" };
 	// Here, we're going to read the individual frames of the video. First, we declare the variable for the
 	// image. Then, we use the cap.read(img) function to read the image and store it in the img variable.
 	cv::VideoCapture cap{ videoPath }; // Variable in which the video is stored.
@@ -33,4 +499,4 @@ int main()
 	cv::destroyAllWindows();
 
 	return 0;
-}
\ No newline at end of file
+}
@@ -1,7 +1,117 @@
+/*
+ * Reading from a webcam
+ * Works like reading a video file, but the VideoCapture is opened with the index of a camera instead of a path.
+ *
+ * Low-latency mode
+ * The camera driver keeps a few frames in a buffer. In the simple loop below we read one frame per loop, so as soon
+ * as the loop is slower than the camera the buffer fills up and cap.read() returns frames that were captured
+ * hundreds of milliseconds ago. --low-latency reads the camera on its own thread (ThreadedCapture from
+ * common/ThreadedCapture.h) as fast as the camera delivers, and keeps only the newest frame in a latest-only slot.
+ * Older frames are dropped, so the loop always shows the newest frame, however slow it is.
+ * Every frame is stamped when the capture thread calls read() for it and again when it's on the screen, and at the
+ * end we print the distribution of the read-to-display latency. It includes grabbing and decoding the frame, but not
+ * the time between the camera taking the picture and read() being called: the driver's own queue can't be seen from
+ * here. --delay MS simulates slow processing, and --policy block keeps every frame (like the driver buffer does) so
+ * we can see the difference.
+ * A video file can be used instead of a camera: it's played in a loop at its own frame rate, so the mode can be tried
+ * on a machine without a camera.
+ *
+ * Usage:
+ *	Source                                  show camera 0
+ *	Source --low-latency [camera|video] [--delay MS] [--policy latest|block] [--frames N]
+ */
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
 #include <opencv2/opencv.hpp>
+#include "../common/Percentile.h"
+#include "../common/ThreadedCapture.h"
 
-int main()
+int runLowLatency(int argc, char** argv)
 {
+	std::string source{ "0" };
+	int delayMs{ 0 };
+	long long maxFrames{ 0 };
+	DropPolicy policy{ DropPolicy::latestOnly };
+	for (int i{ 2 }; i < argc; ++i)
+	{
+		std::string arg{ argv[i] };
+		if (arg == "--delay" && i + 1 < argc)
+			delayMs = std::max(0, std::stoi(argv[++i]));
+		else if (arg == "--frames" && i + 1 < argc)
+			maxFrames = std::stoll(argv[++i]);
+		else if (arg == "--policy" && i + 1 < argc)
+			policy = std::string{ argv[++i] } == "block" ? DropPolicy::block : DropPolicy::latestOnly;
+		else
+			source = arg;
+	}
+
+	ThreadedCapture capture{ 3, policy };
+	if (!capture.open(source))
+	{
+		std::cerr << "Cannot open " << source << '\n';
+		return 1;
+	}
+
+	bool camera{ std::all_of(source.begin(), source.end(), [](unsigned char c) { return std::isdigit(c); }) };
+	if (camera)
+	{
+		// Ask the driver to keep as few frames as possible (not every backend supports it).
+		capture.capture().set(cv::CAP_PROP_BUFFERSIZE, 1);
+	}
+	else
+	{
+		// A video file stands in for the camera: loop it and deliver it at its own frame rate.
+		double fps{ capture.capture().get(cv::CAP_PROP_FPS) };
+		capture.loop = true;
+		capture.pace = fps > 0 ? fps : 30;
+	}
+	capture.start();
+
+	std::vector<double> latencyMs;
+	while (CapturedFrame frame{ capture.next() })
+	{
+		// Stand-in for processing that is slower than the camera.
+		if (delayMs > 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+
+		cv::imshow("Frame", frame.image());
+		int key{ cv::waitKey(1) };
+
+		// waitKey() draws the window, so now the frame is on the screen.
+		latencyMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+			frame.captured()).count());
+
+		if (key == 'q' || (maxFrames > 0 && static_cast<long long>(latencyMs.size()) >= maxFrames))
+			break;
+	}
+
+	capture.stop();
+	cv::destroyAllWindows();
+
+	std::sort(latencyMs.begin(), latencyMs.end());
+	std::cout << "Shown: " << latencyMs.size() << " frames, captured: " << capture.decoded() << ", dropped: "
+		<< capture.dropped() << '\n';
+	if (!latencyMs.empty())
+	{
+		std::cout << "Read to display latency p50/p95/p99/max: " << percentile(latencyMs, 50) << " / "
+			<< percentile(latencyMs, 95) << " / " << percentile(latencyMs, 99) << " / " << latencyMs.back()
+			<< " ms\n";
+		std::cout << "(from the read() that grabbed and decoded the frame; time spent in the camera driver before "
+			"that read() isn't included)\n";
+	}
+
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1 && std::string{ argv[1] } == "--low-latency")
+		return runLowLatency(argc, argv);
+
 	// Capture from web-cam. Zero represents the default camera being used to capture the video. 
 	cv::VideoCapture cap(0);
 	cv::Mat frame;
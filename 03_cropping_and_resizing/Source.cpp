@@ -11,12 +11,51 @@
  *	1. Define the header files and namespaces.
  *	2. Declare variables for the original image, img, cropped image, croppedImg, and resized image, resizedImg.
  *	3. Read the image and store it in img.
+ *
+ * Resizing while decoding
+ * When we only need a smaller image, imread() followed by resize() decodes every pixel only to throw most of them
+ * away. loadImage() from common/ImageLoader.h lets the JPEG decoder produce a half, quarter or eighth size image
+ * directly and finishes with a small resize. Before the lesson starts we time both ways on img/Mount_Everest.jpg and
+ * compare how much memory the decoded pixels take.
  */
+#include <chrono>
 #include <iostream>
 #include <opencv2/opencv.hpp>
+#include "../common/ImageLoader.h"
+
+// Times imread() + resize() against loadImage() for one scale.
+void benchmarkLoading(const std::string& path, double scale)
+{
+	const int runs{ 10 };
+	cv::Mat full, resized, loaded;
+	auto start{ std::chrono::steady_clock::now() };
+	for (int r{ 0 }; r < runs; ++r)
+	{
+		full = cv::imread(path);
+		cv::resize(full, resized, cv::Size(), scale, scale, cv::INTER_AREA);
+	}
+	auto middle{ std::chrono::steady_clock::now() };
+	for (int r{ 0 }; r < runs; ++r)
+		loaded = loadImage(path, scale, scale);
+	auto end{ std::chrono::steady_clock::now() };
+
+	double readMs{ std::chrono::duration<double, std::milli>(middle - start).count() / runs };
+	double loadMs{ std::chrono::duration<double, std::milli>(end - middle).count() / runs };
+	// loadImage() never holds more than the reduced image the decoder produces.
+	cv::Size header{ jpegSize(path) };
+	int reduction{ image_loader::reductionFor(header, loaded.size()) };
+	std::size_t reducedBytes{ static_cast<std::size_t>((header.width + reduction - 1) / reduction) *
+		((header.height + reduction - 1) / reduction) * loaded.elemSize() };
+	std::cout << "Scale " << scale << " to " << loaded.size() << ": imread + resize " << readMs << " ms ("
+		<< full.total() * full.elemSize() / 1024 << " KB decoded), loadImage " << loadMs << " ms ("
+		<< reducedBytes / 1024 << " KB decoded, " << readMs / loadMs << "x)\n";
+}
 
 int main()
 {
+	for (double scale : { 0.5, 0.25, 0.1 })
+		benchmarkLoading("../img/Mount_Everest.jpg", scale);
+
 	// Reading image
 	std::string imagePath{ "../img/chile.jpg" };
 	cv::Mat img{ cv::imread(imagePath) };
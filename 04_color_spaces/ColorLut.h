@@ -0,0 +1,190 @@
+/*
+ * BGR to Lab or HSV through a precomputed 3D lookup table.
+ *
+ * cvtColor(img, lab, COLOR_BGR2Lab) undoes the sRGB gamma, multiplies by a matrix and takes cube roots for every
+ * pixel. But an 8-bit BGR pixel has only 256^3 possible values, and Lab changes smoothly with BGR, so we can compute
+ * the result once on a coarse grid of BGR values and interpolate between the grid points:
+ *	- The table has `nodes` grid points along each of B, G and R (33 by default, so 33^3 entries). Each entry holds
+ *	  the converted color in the same 8-bit ranges as cvtColor() uses, as floats.
+ *	- A pixel falls into one cell of the grid, and its color is the trilinear interpolation of the 8 corners of that
+ *	  cell. The cell and the position inside it are looked up in a 256-entry table per channel.
+ *	- Hue is an angle: 179 and 0 are neighbors. Before interpolating we move the corner hues next to each other, so a
+ *	  cell on the red wrap-around doesn't average to cyan.
+ * More nodes mean a bigger table and a smaller error. The error is largest where the conversion isn't smooth, e.g. the
+ * hue of almost gray pixels.
+ *
+ * The table is built once with cvtColor() on the grid points (in float precision) and saved to a file, under a
+ * temporary name that is renamed when complete (AtomicWrite.h), so a run starting at the same moment never maps half a
+ * table. Later runs map that file into memory (MappedFile) and use it right away.
+ */
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include "../common/AtomicWrite.h"
+#include "../common/MappedFile.h"
+
+class ColorLut
+{
+public:
+	// Opens the table of `code` (cv::COLOR_BGR2Lab or cv::COLOR_BGR2HSV) with `nodes` points per axis from cachePath.
+	// If the file is missing or was made for another conversion it's built and saved first.
+	bool open(const std::string& cachePath, int code, int nodes = 33)
+	{
+		if (code != cv::COLOR_BGR2Lab && code != cv::COLOR_BGR2HSV)
+			return false;
+		nodes = std::max(2, std::min(256, nodes));
+		built_ = false;
+		if (!load(cachePath, code, nodes))
+		{
+			if (!build(cachePath, code, nodes) || !load(cachePath, code, nodes))
+				return false;
+			built_ = true;
+		}
+
+		code_ = code;
+		nodes_ = nodes;
+		// Cell and position inside the cell for every 8-bit value. The last value lands at the end of the last cell.
+		for (int v{ 0 }; v < 256; ++v)
+		{
+			float position{ v * (nodes - 1) / 255.0f };
+			index_[v] = std::min(nodes - 2, static_cast<int>(position));
+			fraction_[v] = position - index_[v];
+		}
+		return true;
+	}
+
+	// True if open() had to build the table instead of loading it.
+	bool built() const { return built_; }
+	std::size_t bytes() const { return file_.size(); }
+
+	// Converts an 8-bit BGR image, like cvtColor(src, dst, code).
+	void apply(const cv::Mat& src, cv::Mat& dst) const
+	{
+		CV_Assert(table_ && src.type() == CV_8UC3);
+		dst.create(src.size(), CV_8UC3);
+		bool hue{ code_ == cv::COLOR_BGR2HSV };
+		const int sr{ 3 }, sg{ nodes_ * 3 }, sb{ nodes_ * nodes_ * 3 };
+
+		cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range)
+			{
+				for (int y{ range.start }; y < range.end; ++y)
+				{
+					const uchar* in{ src.ptr<uchar>(y) };
+					uchar* out{ dst.ptr<uchar>(y) };
+					for (int x{ 0 }; x < src.cols; ++x, in += 3, out += 3)
+					{
+						float fb{ fraction_[in[0]] }, fg{ fraction_[in[1]] }, fr{ fraction_[in[2]] };
+						const float* c{ table_ + index_[in[0]] * sb + index_[in[1]] * sg + index_[in[2]] * sr };
+
+						for (int ch{ 0 }; ch < 3; ++ch)
+						{
+							float v[8]{ c[ch], c[sr + ch], c[sg + ch], c[sg + sr + ch], c[sb + ch], c[sb + sr + ch],
+								c[sb + sg + ch], c[sb + sg + sr + ch] };
+							if (hue && ch == 0)
+							{
+								// Unwrap the corner hues around the first one (the 8-bit hue range is 0..180).
+								for (int k{ 1 }; k < 8; ++k)
+								{
+									if (v[k] - v[0] > 90.0f)
+										v[k] -= 180.0f;
+									else if (v[0] - v[k] > 90.0f)
+										v[k] += 180.0f;
+								}
+							}
+
+							float r0{ v[0] + (v[1] - v[0]) * fr }, r1{ v[2] + (v[3] - v[2]) * fr };
+							float r2{ v[4] + (v[5] - v[4]) * fr }, r3{ v[6] + (v[7] - v[6]) * fr };
+							float g0{ r0 + (r1 - r0) * fg }, g1{ r2 + (r3 - r2) * fg };
+							int value{ cvRound(g0 + (g1 - g0) * fb) };
+
+							if (hue && ch == 0)
+								value = (value % 180 + 180) % 180;
+							out[ch] = cv::saturate_cast<uchar>(value);
+						}
+					}
+				}
+			});
+	}
+
+private:
+	struct Header
+	{
+		char magic[8];
+		std::int32_t code, nodes;
+	};
+
+	static constexpr char magic[8]{ 'B', 'G', 'R', 'L', 'U', 'T', '1', '\0' };
+
+	bool load(const std::string& path, int code, int nodes)
+	{
+		table_ = nullptr;
+		if (!file_.open(path))
+			return false;
+		const auto* header{ static_cast<const Header*>(file_.data()) };
+		std::size_t expected{ sizeof(Header) + static_cast<std::size_t>(nodes) * nodes * nodes * 3 * sizeof(float) };
+		if (file_.size() != expected || std::memcmp(header->magic, magic, sizeof(magic)) != 0 ||
+			header->code != code || header->nodes != nodes)
+		{
+			file_.close();
+			return false;
+		}
+		table_ = reinterpret_cast<const float*>(static_cast<const char*>(file_.data()) + sizeof(Header));
+		return true;
+	}
+
+	// Converts the grid points with cvtColor() in float precision and writes them scaled to the 8-bit ranges:
+	// Lab L * 255 / 100, a + 128, b + 128 and HSV H / 2, S * 255, V * 255.
+	static bool build(const std::string& path, int code, int nodes)
+	{
+		cv::Mat grid(nodes * nodes, nodes, CV_32FC3);
+		for (int b{ 0 }; b < nodes; ++b)
+		{
+			for (int g{ 0 }; g < nodes; ++g)
+			{
+				cv::Vec3f* row{ grid.ptr<cv::Vec3f>(b * nodes + g) };
+				for (int r{ 0 }; r < nodes; ++r)
+					row[r] = cv::Vec3f(b / (nodes - 1.0f), g / (nodes - 1.0f), r / (nodes - 1.0f));
+			}
+		}
+
+		cv::Mat converted;
+		cv::cvtColor(grid, converted, code);
+		for (int y{ 0 }; y < converted.rows; ++y)
+		{
+			cv::Vec3f* row{ converted.ptr<cv::Vec3f>(y) };
+			for (int x{ 0 }; x < converted.cols; ++x)
+			{
+				cv::Vec3f& p{ row[x] };
+				if (code == cv::COLOR_BGR2Lab)
+					p = cv::Vec3f(p[0] * 255.0f / 100.0f, p[1] + 128.0f, p[2] + 128.0f);
+				else
+					p = cv::Vec3f(p[0] / 2.0f, p[1] * 255.0f, p[2] * 255.0f);
+			}
+		}
+
+		Header header{};
+		std::memcpy(header.magic, magic, sizeof(magic));
+		header.code = code;
+		header.nodes = nodes;
+		// Another process may map the file while we write it, so it's written to a temporary file and renamed.
+		return writeFileAtomically(path, [&](std::ostream& out)
+			{
+				out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+				for (int y{ 0 }; y < converted.rows; ++y)
+					out.write(converted.ptr<char>(y), static_cast<std::streamsize>(converted.cols * sizeof(cv::Vec3f)));
+			});
+	}
+
+	MappedFile file_;
+	const float* table_{ nullptr };
+	int code_{ 0 }, nodes_{ 0 };
+	bool built_{ false };
+	int index_[256]{};
+	float fraction_[256]{};
+};
@@ -0,0 +1,57 @@
+/*
+ * Several color conversions of one image in a single pass over it.
+ *
+ * Calling cv::cvtColor() once per color space reads the whole source image from memory once per call. For a large
+ * image that doesn't fit in the CPU cache, memory bandwidth, not the arithmetic, sets the speed. convertColors()
+ * cuts the image into strips of rows small enough to stay in the L2 cache, and runs all requested conversions on one
+ * strip before it moves on to the next. So every source pixel comes from memory once and is reused from the cache by
+ * the other conversions. The strips are processed in parallel with cv::parallel_for_(), and each conversion of a
+ * strip is still done by cvtColor() with its SIMD code.
+ *
+ * Only conversions where each output pixel depends on the same input pixel alone can be split like this (BGR to
+ * gray, HSV, Lab, RGB, YCrCb, ...), not the demosaicing codes.
+ */
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+// Converts `src` with every code of `codes` (e.g. cv::COLOR_BGR2HSV) into outputs[i]. blockBytes is roughly how much
+// memory one strip (source plus all outputs) may take.
+inline void convertColors(const cv::Mat& src, const std::vector<int>& codes, std::vector<cv::Mat>& outputs,
+	std::size_t blockBytes = 256u << 10)
+{
+	outputs.resize(codes.size());
+	if (src.empty())
+		return;
+
+	// Convert one pixel to learn the type of every output, then allocate them all for the whole image.
+	std::size_t bytesPerRow{ src.cols * src.elemSize() };
+	cv::Mat probe;
+	for (std::size_t i{ 0 }; i < codes.size(); ++i)
+	{
+		cv::cvtColor(src(cv::Rect(0, 0, 1, 1)), probe, codes[i]);
+		outputs[i].create(src.size(), probe.type());
+		bytesPerRow += src.cols * outputs[i].elemSize();
+	}
+
+	int rowsPerStrip{ static_cast<int>(std::max<std::size_t>(1, blockBytes / bytesPerRow)) };
+	int strips{ (src.rows + rowsPerStrip - 1) / rowsPerStrip };
+
+	cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range& range)
+		{
+			for (int s{ range.start }; s < range.end; ++s)
+			{
+				int first{ s * rowsPerStrip }, last{ std::min(src.rows, (s + 1) * rowsPerStrip) };
+				cv::Mat strip{ src.rowRange(first, last) };
+				for (std::size_t i{ 0 }; i < codes.size(); ++i)
+				{
+					// The view keeps pointing into outputs[i], cvtColor() doesn't reallocate it.
+					cv::Mat out{ outputs[i].rowRange(first, last) };
+					cv::cvtColor(strip, out, codes[i]);
+				}
+			}
+		});
+}
@@ -2,18 +2,142 @@
  * What is a color space?
  * A color space is a specific organization of colors. It's essentially a system of representing an array of
  * pixel colors. There are several color spaces, such as BGR, grayscale, HSV, Lab, and many more.
+ *
+ * Converting to several color spaces at once
+ * Below we call cvtColor() four times on the same image, so the image is read from memory four times.
+ * convertColors() from MultiColorConvert.h takes a list of color codes and produces all the images in a single pass:
+ *	std::vector<cv::Mat> outputs;
+ *	convertColors(img, { cv::COLOR_BGR2GRAY, cv::COLOR_BGR2HSV, cv::COLOR_BGR2Lab, cv::COLOR_BGR2RGB }, outputs);
+ * It works on strips of the image that fit in the CPU cache, one strip per core at a time. Before the lesson starts
+ * we time both ways on the full-size image and check that they give the same pixels.
+ *
+ * Lab and HSV from a lookup table
+ * BGR to Lab needs a power function and a cube root for every pixel, which makes it one of the slowest conversions.
+ * ColorLut (ColorLut.h) computes Lab or HSV once for a grid of BGR colors, saves the table to a file in lut_cache/,
+ * and converts an image by interpolating between the grid points. The next runs only map the saved file into memory.
+ * We print the largest difference from cvtColor() for each channel and the time of both.
+ *
+ * Usage:
+ *	Source [--lut-nodes N]    grid points per color axis of the lookup tables (default: 33)
  */
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
 #include <iostream>
+#include <string>
+#include <vector>
 #include <opencv2/opencv.hpp>
+#include "ColorLut.h"
+#include "MultiColorConvert.h"
 
-int main()
+// Times four cvtColor() calls against one convertColors() call with the same codes.
+void benchmarkConversions(const cv::Mat& img)
 {
+	const std::vector<int> codes{ cv::COLOR_BGR2GRAY, cv::COLOR_BGR2HSV, cv::COLOR_BGR2Lab, cv::COLOR_BGR2RGB };
+	const int runs{ 20 };
+	std::vector<cv::Mat> sequential(codes.size()), combined;
+
+	auto start{ std::chrono::steady_clock::now() };
+	for (int r{ 0 }; r < runs; ++r)
+	{
+		for (std::size_t i{ 0 }; i < codes.size(); ++i)
+			cv::cvtColor(img, sequential[i], codes[i]);
+	}
+	auto middle{ std::chrono::steady_clock::now() };
+	for (int r{ 0 }; r < runs; ++r)
+		convertColors(img, codes, combined);
+	auto end{ std::chrono::steady_clock::now() };
+
+	double sequentialMs{ std::chrono::duration<double, std::milli>(middle - start).count() / runs };
+	double combinedMs{ std::chrono::duration<double, std::milli>(end - middle).count() / runs };
+	bool same{ true };
+	for (std::size_t i{ 0 }; i < codes.size(); ++i)
+		same = same && cv::norm(sequential[i], combined[i], cv::NORM_INF) == 0;
+
+	std::cout << img.cols << "x" << img.rows << " image, gray + HSV + Lab + RGB\n";
+	std::cout << "4x cvtColor: " << sequentialMs << " ms, convertColors: " << combinedMs << " ms ("
+		<< sequentialMs / combinedMs << "x), same pixels: " << (same ? "yes" : "no") << '\n';
+}
+
+// Largest difference per channel between two 8-bit 3-channel images. With hue = true the first channel is an angle
+// in 0..180, where 0 and 179 are neighbors.
+cv::Vec3i maxDifference(const cv::Mat& a, const cv::Mat& b, bool hue)
+{
+	cv::Vec3i worst{ 0, 0, 0 };
+	for (int y{ 0 }; y < a.rows; ++y)
+	{
+		const cv::Vec3b* rowA{ a.ptr<cv::Vec3b>(y) };
+		const cv::Vec3b* rowB{ b.ptr<cv::Vec3b>(y) };
+		for (int x{ 0 }; x < a.cols; ++x)
+		{
+			for (int ch{ 0 }; ch < 3; ++ch)
+			{
+				int d{ std::abs(rowA[x][ch] - rowB[x][ch]) };
+				if (hue && ch == 0)
+					d = std::min(d, 180 - d);
+				worst[ch] = std::max(worst[ch], d);
+			}
+		}
+	}
+	return worst;
+}
+
+// Compares the lookup-table conversion with cvtColor() in accuracy and speed.
+void benchmarkLut(const cv::Mat& img, int code, const std::string& name, int nodes)
+{
+	// The tables are kept out of the working directory, in a cache directory of their own.
+	const std::filesystem::path cacheDir{ "lut_cache" };
+	std::error_code error;
+	std::filesystem::create_directories(cacheDir, error);
+
+	ColorLut lut;
+	auto start{ std::chrono::steady_clock::now() };
+	if (!lut.open((cacheDir / (name + "_" + std::to_string(nodes) + ".lut")).string(), code, nodes))
+	{
+		std::cerr << "Cannot create the " << name << " lookup table\n";
+		return;
+	}
+	double openMs{ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() };
+
+	const int runs{ 20 };
+	cv::Mat reference, approximated;
+	start = std::chrono::steady_clock::now();
+	for (int r{ 0 }; r < runs; ++r)
+		cv::cvtColor(img, reference, code);
+	auto middle{ std::chrono::steady_clock::now() };
+	for (int r{ 0 }; r < runs; ++r)
+		lut.apply(img, approximated);
+	auto end{ std::chrono::steady_clock::now() };
+
+	double cvtMs{ std::chrono::duration<double, std::milli>(middle - start).count() / runs };
+	double lutMs{ std::chrono::duration<double, std::milli>(end - middle).count() / runs };
+	cv::Vec3i error{ maxDifference(reference, approximated, code == cv::COLOR_BGR2HSV) };
+	std::cout << name << " table (" << nodes << "^3 nodes, " << lut.bytes() / 1024 << " KB) "
+		<< (lut.built() ? "built" : "mapped") << " in " << openMs << " ms\n";
+	std::cout << "cvtColor: " << cvtMs << " ms, lookup table: " << lutMs << " ms (" << cvtMs / lutMs
+		<< "x), largest difference per channel: " << error[0] << ", " << error[1] << ", " << error[2] << '\n';
+}
+
+int main(int argc, char** argv)
+{
+	int lutNodes{ 33 };
+	for (int i{ 1 }; i + 1 < argc; ++i)
+	{
+		if (std::string{ argv[i] } == "--lut-nodes")
+			lutNodes = std::atoi(argv[++i]);
+	}
+
 	// Converting from BGR to grayscale
 	// OpenCV reads images in BGR format. To convert an image to grayscale, we have to use the cvtColor() method
 	// of the OpenCV library. We need to give three parameters to this function: 1) Original image, 2) Mat object
 	// that stores the converted images, 3) Color code, for example COLOR_BGR2GRAY changes the color space from
 	// BGR to grayscale.
 	cv::Mat img{ cv::imread("../img/chile.jpg") };
+	// Compare the single-pass conversion with separate cvtColor calls on the full-size image
+	benchmarkConversions(img);
+	benchmarkLut(img, cv::COLOR_BGR2Lab, "bgr2lab", lutNodes);
+	benchmarkLut(img, cv::COLOR_BGR2HSV, "bgr2hsv", lutNodes);
 	// Resize image for display purpose
 	cv::resize(img, img, cv::Size(), 0.7, 0.55);
 	// Create Mat object to store grayscale img
@@ -28,18 +28,24 @@
  *  2. The translated image.
  *  3. The translation matrix.
  *  4. The dimensions.
+ *
+ * Shifting by whole pixels
+ * warpAffine() interpolates every output pixel, even when the shift is a whole number of pixels and every pixel just
+ * moves to another place. warpAffineFast() from common/FastAffine.h recognizes such a matrix and copies the image
+ * instead, with the same result. We round the shift to whole pixels, compare both ways and print which path ran.
  */
 #include <opencv2/opencv.hpp>
+#include <chrono>
+#include <cmath>
 #include <iostream>
 #include <vector>
+#include "../common/FastAffine.h"
+#include "../common/ImageLoader.h"
 
 int main()
 {
-    // Read the image from the path
-    cv::Mat img{ cv::imread("../img/chile.jpg") };
-
-    // Resize image for displaying purpose
-    cv::resize(img, img, cv::Size(), 0.7, 0.55);
+    // Read the image from the path, already resized for displaying purpose (see common/ImageLoader.h)
+    cv::Mat img{ loadImage("../img/chile.jpg", 0.7, 0.55) };
 
     // Create placeholders for translated image
     cv::Mat translatedImage;
@@ -47,9 +53,9 @@ int main()
     // Get width and height of the image, we can use C++17 structured binding
     auto [width, height] = img.size();
 
-    // Create x and y from width and height
-    float x = static_cast<float>(width) / 3;
-    float y = static_cast<float>(height) / 3;
+    // Create x and y from width and height, rounded to whole pixels
+    float x = std::round(static_cast<float>(width) / 3);
+    float y = std::round(static_cast<float>(height) / 3);
 
     // Create translation matrix
     std::vector<float> warp_values {1.0, 0.0, x, 0.0, 1.0, y};
@@ -58,6 +64,24 @@ int main()
     // Translating image
     cv::warpAffine(img, translatedImage, translationMatrix, img.size());
 
+    // The same translation without interpolation, timed against warpAffine
+    const int runs{ 100 };
+    cv::Mat fastImage;
+    AffinePath path{};
+    auto start{ std::chrono::steady_clock::now() };
+    for (int i{ 0 }; i < runs; ++i)
+        cv::warpAffine(img, translatedImage, translationMatrix, img.size());
+    auto middle{ std::chrono::steady_clock::now() };
+    for (int i{ 0 }; i < runs; ++i)
+        path = warpAffineFast(img, fastImage, translationMatrix, img.size());
+    auto end{ std::chrono::steady_clock::now() };
+
+    double warpMs{ std::chrono::duration<double, std::milli>(middle - start).count() / runs };
+    double fastMs{ std::chrono::duration<double, std::milli>(end - middle).count() / runs };
+    bool same{ cv::norm(translatedImage, fastImage, cv::NORM_INF) == 0 };
+    std::cout << "warpAffine: " << warpMs << " ms, warpAffineFast (" << toString(path) << "): " << fastMs << " ms ("
+        << warpMs / fastMs << "x), same pixels: " << (same ? "yes" : "no") << '\n';
+
     // Display images
     cv::imshow("Original Image", img);
     cv::imshow("Translated Image", translatedImage);
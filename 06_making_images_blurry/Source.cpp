@@ -18,16 +18,85 @@
  * Here, the kernelSize is the size of the window where the blur is applied. It should be in odd numbers. This
  * will make the previous layer's pixels similar to the output pixel.If we use even numbers, we might suffer
  * from aliasing errors. Increasing the number will increase the blurriness of teh image
+ *
+ * Large kernels
+ * GaussianBlur() gets slower the bigger the kernel is, and privacy blurs use kernels of 51 to 151 pixels. boxBlur()
+ * from common/BoxBlur.h gives almost the same result with three box filters in each direction, which cost the same
+ * for any kernel size. Before the lesson starts we time both for a range of kernel sizes, print the times and the
+ * largest difference, and plot the time against the kernel size.
+ *
+ * Blurring only some regions
+ * To hide faces or license plates we don't need to blur the whole image. blurRegions() from common/RegionBlur.h
+ * takes a list of rectangles (blurMask() takes a mask) and blurs only around them, in place:
+ *	std::vector<cv::Rect> regions{ { 100, 100, 80, 80 }, { 400, 200, 120, 60 } };
+ *	blurRegions(img, regions, 51);
+ * We time it against blurring the whole image and copying the regions back.
  */
 #include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../common/BoxBlur.h"
+#include "../common/ImageLoader.h"
+#include "../common/RegionBlur.h"
 
-int main()
+// Average time of `runs` calls of blur() in milliseconds.
+template <typename Blur>
+double timeBlur(Blur blur, int runs = 5)
+{
+	auto start{ std::chrono::steady_clock::now() };
+	for (int r{ 0 }; r < runs; ++r)
+		blur();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / runs;
+}
+
+// Times GaussianBlur() and boxBlur() for every kernel size and draws both curves into one chart.
+cv::Mat benchmarkKernelSizes(const cv::Mat& img, const std::vector<int>& kernelSizes)
 {
-	// Read an image from disk
-	cv::Mat img{ cv::imread("../img/chile.jpg") };
+	std::vector<double> gaussianMs, boxMs;
+	cv::Mat gaussian, box;
+	for (int k : kernelSizes)
+	{
+		gaussianMs.push_back(timeBlur([&]() { cv::GaussianBlur(img, gaussian, cv::Size(k, k), 0); }));
+		boxMs.push_back(timeBlur([&]() { boxBlur(img, box, k); }));
+		std::cout << "kernel " << k << ": GaussianBlur " << gaussianMs.back() << " ms, boxBlur " << boxMs.back()
+			<< " ms, largest difference: " << cv::norm(gaussian, box, cv::NORM_INF) << '\n';
+	}
 
-	// Resize for displaying purpose
-	cv::resize(img, img, cv::Size(), 0.7, 0.55);
+	// Time (up) against kernel size (right), GaussianBlur in red, boxBlur in green.
+	const int width{ 640 }, height{ 400 }, margin{ 40 };
+	cv::Mat chart(height, width, CV_8UC3, cv::Scalar(255, 255, 255));
+	double maxMs{ std::max(*std::max_element(gaussianMs.begin(), gaussianMs.end()),
+		*std::max_element(boxMs.begin(), boxMs.end())) };
+	auto point{ [&](std::size_t i, double ms)
+		{
+			double span{ static_cast<double>(std::max(1, kernelSizes.back() - kernelSizes.front())) };
+			double x{ (kernelSizes[i] - kernelSizes.front()) / span }, y{ ms / maxMs };
+			return cv::Point(margin + cvRound(x * (width - 2 * margin)), height - margin - cvRound(y * (height - 2 * margin)));
+		} };
+	cv::line(chart, { margin, height - margin }, { width - margin, height - margin }, cv::Scalar(0, 0, 0));
+	cv::line(chart, { margin, height - margin }, { margin, margin }, cv::Scalar(0, 0, 0));
+	for (std::size_t i{ 1 }; i < kernelSizes.size(); ++i)
+	{
+		cv::line(chart, point(i - 1, gaussianMs[i - 1]), point(i, gaussianMs[i]), cv::Scalar(0, 0, 255), 2);
+		cv::line(chart, point(i - 1, boxMs[i - 1]), point(i, boxMs[i]), cv::Scalar(0, 160, 0), 2);
+	}
+	for (std::size_t i{ 0 }; i < kernelSizes.size(); ++i)
+		cv::putText(chart, std::to_string(kernelSizes[i]), point(i, 0) + cv::Point(-8, 20), cv::FONT_HERSHEY_PLAIN, 1,
+			cv::Scalar(0, 0, 0));
+	cv::putText(chart, std::to_string(maxMs) + " ms", { margin + 5, margin - 10 }, cv::FONT_HERSHEY_PLAIN, 1,
+		cv::Scalar(0, 0, 0));
+	cv::putText(chart, "GaussianBlur", { width - 200, margin + 10 }, cv::FONT_HERSHEY_PLAIN, 1, cv::Scalar(0, 0, 255));
+	cv::putText(chart, "boxBlur", { width - 200, margin + 30 }, cv::FONT_HERSHEY_PLAIN, 1, cv::Scalar(0, 160, 0));
+	return chart;
+}
+
+int main()
+{
+	// Read an image from disk, already resized for displaying purpose (see common/ImageLoader.h)
+	cv::Mat img{ loadImage("../img/chile.jpg", 0.7, 0.55) };
 
 	// Blur the image
 	cv::Mat blurredImg;
@@ -35,9 +104,32 @@ int main()
 	int sigmaX = 0;
 	cv::GaussianBlur(img, blurredImg, kernel, sigmaX);
 
+	// Compare the cost of both blurs for kernel sizes from 7 to 151, and blur with the largest one
+	cv::Mat chart{ benchmarkKernelSizes(img, { 7, 15, 31, 51, 71, 101, 125, 151 }) };
+	cv::Mat boxBlurredImg;
+	boxBlur(img, boxBlurredImg, 151);
+
+	// Blur a few regions only, and the same regions by blurring the whole image and copying them back
+	std::vector<cv::Rect> regions{ { 100, 100, 80, 80 }, { 150, 140, 80, 80 }, { 500, 250, 120, 60 } };
+	cv::Mat regionImg, wholeImg;
+	double regionMs{ timeBlur([&]() { img.copyTo(regionImg); blurRegions(regionImg, regions, 51); }) };
+	double wholeMs{ timeBlur([&]()
+		{
+			img.copyTo(wholeImg);
+			cv::Mat blurred;
+			boxBlur(img, blurred, 51);
+			for (const cv::Rect& r : regions)
+				blurred(r).copyTo(wholeImg(r));
+		}) };
+	std::cout << "Regions only: " << regionMs << " ms, whole image: " << wholeMs << " ms, same pixels: "
+		<< (cv::norm(regionImg, wholeImg, cv::NORM_INF) == 0 ? "yes" : "no") << '\n';
+
 	// Show images
 	cv::imshow("Original Image", img);
 	cv::imshow("Blurred Image", blurredImg);
+	cv::imshow("Box Blurred Image (151x151)", boxBlurredImg);
+	cv::imshow("Blur Time against Kernel Size", chart);
+	cv::imshow("Blurred Regions", regionImg);
 	cv::waitKey(0);
 
 	cv::destroyAllWindows();
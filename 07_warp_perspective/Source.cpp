@@ -25,10 +25,42 @@
  *	3. The warp perspective matrix.
  *	4. The dimensions of the image.
  * cv::warpPerspective(img, warpedImage, matrix, Point(w, h));
+ *
+ * Reusing the warp
+ * For every output pixel, warpPerspective() calculates where in the original image it comes from. If we warp the
+ * same quad over and over (for example a camera mounted above a desk), we calculate the same positions every time.
+ * WarpCache from common/WarpCache.h calculates them once, stores them as remap tables and then only needs
+ * cv::remap() for the following warps:
+ * WarpCache cache;
+ * cache.warp(img, pointA, cv::Size(w, h), warpedImage);
+ * The cache recognizes a quad when every corner is within a couple of pixels of a quad it has seen before. It
+ * counts hits and misses, so we can check how often the tables were reused.
+ * When the matrix itself is known and fixed, TransformEngine from common/TransformEngine.h takes it directly (the
+ * same class also takes the affine matrices of lesson 05b) and builds the tables once:
+ * TransformEngine engine{ matrix, img.size(), cv::Size(w, h) };
+ * engine.apply(img, warpedImage);
+ *
+ * Decoding only the document
+ * note.jpg is 4608x3456 pixels, and the note covers only a part of it. loadJpegRegion() from common/JpegRegion.h
+ * decodes only the rectangle around the quad (jpegRegionFor()) and tells where that rectangle starts in the full
+ * image. Moving the quad by that origin keeps the warp the same:
+ * cv::Point origin;
+ * cv::Mat region{ loadJpegRegion("../img/note.jpg", jpegRegionFor(pointA), origin) };
+ * for (auto& p : pointA) p -= cv::Point2f(origin);
+ * We time the full decode and warp against the region decode and warp, and compare the results. The region decode
+ * only skips the work for the rest of the file when libjpeg-turbo is used, which has to be asked for when building:
+ * g++ ... -DJPEG_REGION_TURBO ... -ljpeg
+ * Without it loadJpegRegion() decodes the whole file and cuts the rectangle out.
  */
+#include <chrono>
+#include <iostream>
 #include <vector>
 #include <opencv2/opencv.hpp>
 
+#include "../common/JpegRegion.h"
+#include "../common/TransformEngine.h"
+#include "../common/WarpCache.h"
+
 int main()
 {
 	// Create placeholders
@@ -52,9 +84,67 @@ int main()
 
 	cv::warpPerspective(img, warpedImage, matrix, cv::Point(w, h));
 
+	// Warp the same quad many times, once with warpPerspective and once with the cache
+	const int runs{ 100 };
+	cv::Mat cachedImage;
+	WarpCache cache;
+
+	auto start{ std::chrono::steady_clock::now() };
+	for (int i{ 0 }; i < runs; ++i)
+		cv::warpPerspective(img, warpedImage, cv::getPerspectiveTransform(pointA, pointB), cv::Point(w, h));
+	auto middle{ std::chrono::steady_clock::now() };
+	for (int i{ 0 }; i < runs; ++i)
+		cache.warp(img, pointA.data(), cv::Size(w, h), cachedImage);
+	auto end{ std::chrono::steady_clock::now() };
+	TransformEngine engine{ matrix, img.size(), cv::Size(w, h) };
+	cv::Mat engineImage;
+	auto engineStart{ std::chrono::steady_clock::now() };
+	for (int i{ 0 }; i < runs; ++i)
+		engine.apply(img, engineImage);
+	auto engineEnd{ std::chrono::steady_clock::now() };
+
+	std::cout << "warpPerspective: " << std::chrono::duration<double, std::milli>(middle - start).count() / runs
+		<< " ms per warp\n";
+	std::cout << "WarpCache:       " << std::chrono::duration<double, std::milli>(end - middle).count() / runs
+		<< " ms per warp (" << cache.hits() << " hits, " << cache.misses() << " misses)\n";
+	std::cout << "TransformEngine: " << std::chrono::duration<double, std::milli>(engineEnd - engineStart).count() / runs
+		<< " ms per warp, largest difference from warpPerspective: "
+		<< cv::norm(warpedImage, engineImage, cv::NORM_INF) << '\n';
+
+	// Decode only the rectangle around the quad, and warp with the quad moved into that rectangle
+	const int decodeRuns{ 10 };
+	cv::Mat fullWarp, regionWarp;
+	cv::Point origin;
+	cv::Mat region;
+	auto decodeStart{ std::chrono::steady_clock::now() };
+	for (int i{ 0 }; i < decodeRuns; ++i)
+	{
+		// The region is in the stored orientation, so the full image has to be too.
+		cv::Mat full{ cv::imread("../img/note.jpg", cv::IMREAD_COLOR | cv::IMREAD_IGNORE_ORIENTATION) };
+		cv::warpPerspective(full, fullWarp, cv::getPerspectiveTransform(pointA, pointB), cv::Size(w, h));
+	}
+	auto decodeMiddle{ std::chrono::steady_clock::now() };
+	for (int i{ 0 }; i < decodeRuns; ++i)
+	{
+		region = loadJpegRegion("../img/note.jpg", jpegRegionFor(pointA), origin);
+		std::vector<cv::Point2f> shifted{ pointA };
+		for (auto& p : shifted)
+			p -= cv::Point2f(origin);
+		cv::warpPerspective(region, regionWarp, cv::getPerspectiveTransform(shifted, pointB), cv::Size(w, h));
+	}
+	auto decodeEnd{ std::chrono::steady_clock::now() };
+
+	double fullMs{ std::chrono::duration<double, std::milli>(decodeMiddle - decodeStart).count() / decodeRuns };
+	double regionMs{ std::chrono::duration<double, std::milli>(decodeEnd - decodeMiddle).count() / decodeRuns };
+	std::cout << "Full decode + warp: " << fullMs << " ms (" << img.size() << "), region decode + warp: " << regionMs
+		<< " ms (" << region.size() << " at " << origin << "), largest difference: "
+		<< cv::norm(fullWarp, regionWarp, cv::NORM_INF) << '\n';
+
 	// Display images
 	cv::imshow("Image", img);
 	cv::imshow("Image Warp", warpedImage);
+	cv::imshow("Image Warp (cached)", cachedImage);
+	cv::imshow("Image Warp (region decode)", regionWarp);
 	cv::waitKey(0);
 
 	cv::destroyAllWindows();
@@ -9,15 +9,44 @@
  * hconcat(img1, img2, finalImg)
  * There are two different images, img1 and img2, they'll be joined horizontally and stored in the variable finalImg.
  * Note: All the images to be stacked should be the same size.
+ *
+ * Reading the same images again and again
+ * Here both images come from an ImageCache (common/ImageCache.h). The first run decodes manchester.jpg once in color
+ * and once in grayscale and keeps the pixels in the image_cache directory. Every later read, in this run or the next
+ * one, maps those pixels into memory instead of decoding the JPEG again. Before the lesson starts we time repeated
+ * imread() calls against repeated cached reads.
  */
+#include <chrono>
+#include <iostream>
 #include <string>
 #include <opencv2/opencv.hpp>
+#include "../common/ImageCache.h"
+
+// Times `runs` reads of one image with cv::imread() and with the cache.
+void benchmarkCache(ImageCache& cache, const std::string& path, int runs)
+{
+	auto start{ std::chrono::steady_clock::now() };
+	for (int r{ 0 }; r < runs; ++r)
+		cv::Mat img{ cv::imread(path) };
+	auto middle{ std::chrono::steady_clock::now() };
+	for (int r{ 0 }; r < runs; ++r)
+		cv::Mat img{ cache.imread(path) };
+	auto end{ std::chrono::steady_clock::now() };
+
+	double readMs{ std::chrono::duration<double, std::milli>(middle - start).count() / runs };
+	double cacheMs{ std::chrono::duration<double, std::milli>(end - middle).count() / runs };
+	std::cout << "imread: " << readMs << " ms, cached: " << cacheMs << " ms (" << readMs / cacheMs << "x), hits: "
+		<< cache.hits() << ", misses: " << cache.misses() << ", cache size: " << cache.bytes() / 1024 << " KB\n";
+}
 
 int main()
 {
+	ImageCache cache{ "image_cache", 64u << 20 };
+	benchmarkCache(cache, "../img/manchester.jpg", 100);
+
 	// Read original image and image in grayscale
-	cv::Mat img1{ cv::imread("../img/manchester.jpg") };
-	cv::Mat img2{ cv::imread("../img/manchester.jpg", cv::IMREAD_GRAYSCALE) };
+	cv::Mat img1{ cache.imread("../img/manchester.jpg") };
+	cv::Mat img2{ cache.imread("../img/manchester.jpg", cv::IMREAD_GRAYSCALE) };
 
 	// Convert img2
 	cv::cvtColor(img2, img2, cv::COLOR_GRAY2BGR);
@@ -29,14 +29,12 @@
  */
 #include <opencv2/opencv.hpp>
 #include <string>
+#include "../common/ImageLoader.h"
 
 int main()
 {
-	// Read image from disk
-	cv::Mat img{ cv::imread("../img/chile.jpg") };
-
-	// Resize img for display purpose
-	cv::resize(img, img, cv::Size(), 0.5, 0.5);
+	// Read image from disk, resized for display purpose while decoding (see common/ImageLoader.h)
+	cv::Mat img{ loadImage("../img/chile.jpg", 0.5, 0.5) };
 
 	// Convert to grayscale
 	cv::Mat src_gray;
@@ -12,14 +12,12 @@
  *	5. The fifth parameter is the gradient's value in the y-direction.
  */
 #include <opencv2/opencv.hpp>
+#include "../common/ImageLoader.h"
 
 int main()
 {
-	// Load image from disk
-	cv::Mat img{ cv::imread("../img/chile.jpg") };
-
-	// Resize the image in sake of display
-	cv::resize(img, img, cv::Size(), 0.5, 0.5);
+	// Load image from disk, resized in sake of display while decoding (see common/ImageLoader.h)
+	cv::Mat img{ loadImage("../img/chile.jpg", 0.5, 0.5) };
 
 	// Convert image into grayscale
 	cv::Mat grayImg;
@@ -44,14 +44,67 @@
  *	   contours.
  *	4. The fourth parameter is the scalar value of the color to be given while drawing.
  *	5. The fifth parameter is the thickness of the drawing. 
+ * With thousands of cells drawContours() walks the image once per contour on one core. The program draws them
+ * through an AnnotationLayer from common/AnnotationLayer.h instead, which adds every contour as a closed polygon and
+ * then draws the image tile by tile on all cores (the pixels differ from drawContours() only where a line crosses a
+ * tile border):
+ *	AnnotationLayer layer{ img.size() };
+ *	for (const auto& contour : contours)
+ *		layer.polygon(contour, true, cv::Scalar(255, 0, 255), 2);
+ *	layer.render(img);
+ *
+ * Contours of very large images
+ * findContours() runs on a single core. For a microscopy slide of 20k x 20k pixels with millions of cells, that is
+ * far too slow. findContoursTiled() from TiledContours.h gives the same contours, but splits the work over all cores:
+ * it labels the connected groups of edge pixels tile by tile, joins the groups that cross the tile seams and then
+ * traces every group on its own. cv::Canny() already runs in parallel inside OpenCV, so it's used as it is.
+ * The program times both ways and checks that they give exactly the same contours.
+ *
+ * Usage:
+ *	Source [image] [--tile N] [--threads N]   (default: ../img/redbloodcells.jpg, tiles of 1024, all cores)
  */
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
 #include <vector>
 #include <opencv2/opencv.hpp>
+#include "TiledContours.h"
+#include "../common/AnnotationLayer.h"
+
+// Contours sorted by their first point, so that two lists can be compared regardless of their order.
+std::vector<std::vector<cv::Point>> sortedContours(std::vector<std::vector<cv::Point>> contours)
+{
+	std::sort(contours.begin(), contours.end(), [](const auto& a, const auto& b)
+		{
+			return a[0].y != b[0].y ? a[0].y < b[0].y : a[0].x < b[0].x;
+		});
+	return contours;
+}
 
-int main()
+int main(int argc, char** argv)
 {
+	std::string path{ "../img/redbloodcells.jpg" };
+	int tileSize{ 1024 };
+	for (int i{ 1 }; i < argc; ++i)
+	{
+		std::string arg{ argv[i] };
+		if (arg == "--tile" && i + 1 < argc)
+			tileSize = std::max(16, std::atoi(argv[++i]));
+		else if (arg == "--threads" && i + 1 < argc)
+			cv::setNumThreads(std::atoi(argv[++i]));
+		else
+			path = arg;
+	}
+
 	// Load image from disk
-	cv::Mat img{ cv::imread("../img/redbloodcells.jpg") };
+	cv::Mat img{ cv::imread(path) };
+	if (img.empty())
+	{
+		std::cerr << "Cannot read " << path << '\n';
+		return 1;
+	}
 
 	// Convert image to grayscale
 	cv::Mat grayImg;
@@ -71,10 +124,28 @@ int main()
 	std::vector<cv::Vec4i> hierarchy;
 
 	// Find contours
+	auto start{ std::chrono::steady_clock::now() };
 	cv::findContours(canny, contours, hierarchy, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+	auto middle{ std::chrono::steady_clock::now() };
+
+	// Find the same contours tile by tile
+	std::vector<std::vector<cv::Point>> tiledContours;
+	findContoursTiled(canny, tiledContours, tileSize);
+	auto end{ std::chrono::steady_clock::now() };
+
+	double serialMs{ std::chrono::duration<double, std::milli>(middle - start).count() };
+	double tiledMs{ std::chrono::duration<double, std::milli>(end - middle).count() };
+	bool identical{ sortedContours(contours) == sortedContours(tiledContours) };
+	std::cout << "findContours: " << contours.size() << " contours in " << serialMs << " ms\n";
+	std::cout << "findContoursTiled (" << cv::getNumThreads() << " threads, tiles of " << tileSize << "): "
+		<< tiledContours.size() << " contours in " << tiledMs << " ms (" << serialMs / tiledMs << "x)\n";
+	std::cout << "Same contours: " << (identical ? "yes" : "no") << '\n';
 
-	// Draw contour on the original image
-	cv::drawContours(img, contours, -1, cv::Scalar(255, 0, 255), 2);
+	// Draw contours on the original image
+	AnnotationLayer layer{ img.size() };
+	for (const auto& contour : contours)
+		layer.polygon(contour, true, cv::Scalar(255, 0, 255), 2);
+	layer.render(img);
 
 	// Show image with contours
 	cv::imshow("Contoured Image", img);
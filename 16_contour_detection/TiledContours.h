@@ -0,0 +1,274 @@
+/*
+ * Outer contours of a huge binary image, found tile by tile on all cores.
+ *
+ * findContours() follows borders in one raster scan of the whole image, on a single core. For a 20k x 20k microscopy
+ * slide with millions of cells that is the slowest part of the lesson. The outer contour of every 8-connected group
+ * of edge pixels (a component) depends only on the pixels of that component, so we can find the components first and
+ * trace each of them on its own:
+ *	1. labelTiles() labels the components of every tile in parallel with connectedComponentsWithStats(), and then
+ *	   merges the labels of pixels that touch across the tile seams with a union-find. Only the seams are visited
+ *	   serially, which is a tiny part of the image.
+ *	2. RETR_EXTERNAL only returns components that are not inside a hole of another one (the interior of a cell ring
+ *	   is a hole). The background is labeled the same way with 4-connectivity, and a component is external if the
+ *	   background pixel left of its first pixel belongs to a background component that touches the image border.
+ *	3. Every external component is cut out of the label image and traced with findContours() in parallel. Inside
+ *	   the cut-out the component is alone, so its contour is exactly the one the whole-image findContours() finds.
+ * The contours are returned in the order findContours() uses: by their first point, from the bottom of the image to
+ * the top.
+ */
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+// Union-find over component labels. The root of a set is always its smallest label.
+class DisjointSet
+{
+public:
+	explicit DisjointSet(int size) : parent_(size)
+	{
+		std::iota(parent_.begin(), parent_.end(), 0);
+	}
+
+	int find(int label)
+	{
+		while (parent_[label] != label)
+		{
+			parent_[label] = parent_[parent_[label]];
+			label = parent_[label];
+		}
+		return label;
+	}
+
+	void unite(int a, int b)
+	{
+		a = find(a);
+		b = find(b);
+		if (a < b)
+			parent_[b] = a;
+		else if (b < a)
+			parent_[a] = b;
+	}
+
+private:
+	std::vector<int> parent_;
+};
+
+// Connected components of the nonzero pixels of a mask. labels holds 0 for the background and 1..count for the
+// components, boxes[i] is the bounding box of component i (boxes[0] is unused).
+struct Components
+{
+	cv::Mat labels;
+	std::vector<cv::Rect> boxes;
+
+	int count() const { return static_cast<int>(boxes.size()) - 1; }
+};
+
+inline std::vector<cv::Rect> makeTiles(cv::Size size, int tileSize)
+{
+	std::vector<cv::Rect> tiles;
+	for (int y{ 0 }; y < size.height; y += tileSize)
+	{
+		for (int x{ 0 }; x < size.width; x += tileSize)
+			tiles.push_back(cv::Rect(x, y, std::min(tileSize, size.width - x), std::min(tileSize, size.height - y)));
+	}
+	return tiles;
+}
+
+// Labels the components of `mask` tile by tile. connectivity is 8 or 4, like for connectedComponents().
+inline void labelTiles(const cv::Mat& mask, int connectivity, int tileSize, Components& components)
+{
+	cv::Mat& labels{ components.labels };
+	labels.create(mask.size(), CV_32S);
+	std::vector<cv::Rect> tiles{ makeTiles(mask.size(), tileSize) };
+	int tileCount{ static_cast<int>(tiles.size()) };
+	std::vector<cv::Mat> stats(tileCount);
+
+	// Each tile writes its local labels 1..n straight into its part of the label image.
+	cv::parallel_for_(cv::Range(0, tileCount), [&](const cv::Range& range)
+		{
+			cv::Mat centroids;
+			for (int t{ range.start }; t < range.end; ++t)
+			{
+				cv::Mat tileLabels{ labels(tiles[t]) };
+				cv::connectedComponentsWithStats(mask(tiles[t]), tileLabels, stats[t], centroids, connectivity, CV_32S);
+			}
+		});
+
+	// Give every tile its own range of labels.
+	std::vector<int> offsets(tileCount + 1, 0);
+	for (int t{ 0 }; t < tileCount; ++t)
+		offsets[t + 1] = offsets[t] + stats[t].rows - 1;
+	int total{ offsets[tileCount] };
+
+	cv::parallel_for_(cv::Range(0, tileCount), [&](const cv::Range& range)
+		{
+			for (int t{ range.start }; t < range.end; ++t)
+			{
+				const cv::Rect& r{ tiles[t] };
+				for (int y{ r.y }; y < r.y + r.height; ++y)
+				{
+					int* row{ labels.ptr<int>(y) };
+					for (int x{ r.x }; x < r.x + r.width; ++x)
+					{
+						if (row[x] != 0)
+							row[x] += offsets[t];
+					}
+				}
+			}
+		});
+
+	// Merge labels that touch across the left and top seam of every tile. With 8-connectivity the diagonal
+	// neighbors on the other side of the seam count too.
+	DisjointSet sets{ total + 1 };
+	int reach{ connectivity == 8 ? 1 : 0 };
+	for (const cv::Rect& r : tiles)
+	{
+		if (r.x > 0)
+		{
+			for (int y{ r.y }; y < r.y + r.height; ++y)
+			{
+				int b{ labels.ptr<int>(y)[r.x] };
+				if (b == 0)
+					continue;
+				for (int ny{ std::max(0, y - reach) }; ny <= std::min(labels.rows - 1, y + reach); ++ny)
+				{
+					int a{ labels.ptr<int>(ny)[r.x - 1] };
+					if (a != 0)
+						sets.unite(a, b);
+				}
+			}
+		}
+		if (r.y > 0)
+		{
+			const int* row{ labels.ptr<int>(r.y) };
+			const int* above{ labels.ptr<int>(r.y - 1) };
+			for (int x{ r.x }; x < r.x + r.width; ++x)
+			{
+				if (row[x] == 0)
+					continue;
+				for (int nx{ std::max(0, x - reach) }; nx <= std::min(labels.cols - 1, x + reach); ++nx)
+				{
+					if (above[nx] != 0)
+						sets.unite(above[nx], row[x]);
+				}
+			}
+		}
+	}
+
+	// Number the merged components 1..count. The root is the smallest label of its set, so it's always numbered
+	// before the other labels of the set.
+	std::vector<int> remap(total + 1, 0);
+	int count{ 0 };
+	for (int label{ 1 }; label <= total; ++label)
+	{
+		int root{ sets.find(label) };
+		remap[label] = root == label ? ++count : remap[root];
+	}
+
+	components.boxes.assign(count + 1, cv::Rect());
+	for (int t{ 0 }; t < tileCount; ++t)
+	{
+		for (int i{ 1 }; i < stats[t].rows; ++i)
+		{
+			const int* s{ stats[t].ptr<int>(i) };
+			cv::Rect box{ tiles[t].x + s[cv::CC_STAT_LEFT], tiles[t].y + s[cv::CC_STAT_TOP], s[cv::CC_STAT_WIDTH],
+				s[cv::CC_STAT_HEIGHT] };
+			cv::Rect& merged{ components.boxes[remap[offsets[t] + i]] };
+			merged = merged.empty() ? box : (merged | box);
+		}
+	}
+
+	cv::parallel_for_(cv::Range(0, labels.rows), [&](const cv::Range& range)
+		{
+			for (int y{ range.start }; y < range.end; ++y)
+			{
+				int* row{ labels.ptr<int>(y) };
+				for (int x{ 0 }; x < labels.cols; ++x)
+					row[x] = remap[row[x]];
+			}
+		});
+}
+
+// Same contours as cv::findContours(edges, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE), computed tile by
+// tile on all cores.
+inline void findContoursTiled(const cv::Mat& edges, std::vector<std::vector<cv::Point>>& contours, int tileSize = 1024)
+{
+	contours.clear();
+	cv::Size size{ edges.size() };
+
+	// Mark the background pixels that can be reached from outside the image.
+	cv::Mat outside(size, CV_8U);
+	{
+		cv::Mat background;
+		cv::compare(edges, 0, background, cv::CMP_EQ);
+		Components gaps;
+		labelTiles(background, 4, tileSize, gaps);
+
+		std::vector<uchar> touchesBorder(gaps.count() + 1, 0);
+		for (int i{ 1 }; i <= gaps.count(); ++i)
+		{
+			const cv::Rect& box{ gaps.boxes[i] };
+			touchesBorder[i] = box.x == 0 || box.y == 0 || box.x + box.width == size.width ||
+				box.y + box.height == size.height;
+		}
+		cv::parallel_for_(cv::Range(0, size.height), [&](const cv::Range& range)
+			{
+				for (int y{ range.start }; y < range.end; ++y)
+				{
+					const int* row{ gaps.labels.ptr<int>(y) };
+					uchar* out{ outside.ptr<uchar>(y) };
+					for (int x{ 0 }; x < size.width; ++x)
+						out[x] = touchesBorder[row[x]];
+				}
+			});
+	}
+
+	Components cells;
+	labelTiles(edges, 8, tileSize, cells);
+
+	int count{ cells.count() };
+	std::vector<std::vector<cv::Point>> traced(count + 1);
+	std::vector<cv::Point> starts(count + 1);
+	cv::parallel_for_(cv::Range(1, count + 1), [&](const cv::Range& range)
+		{
+			cv::Mat cell;
+			std::vector<std::vector<cv::Point>> found;
+			for (int id{ range.start }; id < range.end; ++id)
+			{
+				// The first pixel in reading order is where findContours() starts following the border.
+				const cv::Rect& box{ cells.boxes[id] };
+				const int* row{ cells.labels.ptr<int>(box.y) };
+				int x{ box.x };
+				while (row[x] != id)
+					++x;
+				if (x > 0 && outside.ptr<uchar>(box.y)[x - 1] == 0)
+					continue;
+
+				cv::compare(cells.labels(box), id, cell, cv::CMP_EQ);
+				cv::findContours(cell, found, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE, box.tl());
+				if (!found.empty())
+				{
+					traced[id] = std::move(found[0]);
+					starts[id] = cv::Point(x, box.y);
+				}
+			}
+		});
+
+	std::vector<int> order;
+	for (int id{ 1 }; id <= count; ++id)
+	{
+		if (!traced[id].empty())
+			order.push_back(id);
+	}
+	std::sort(order.begin(), order.end(), [&](int a, int b)
+		{
+			return starts[a].y != starts[b].y ? starts[a].y > starts[b].y : starts[a].x > starts[b].x;
+		});
+
+	contours.reserve(order.size());
+	for (int id : order)
+		contours.push_back(std::move(traced[id]));
+}
@@ -0,0 +1,481 @@
+/*
+ * Haar cascade in a precompiled binary file that is loaded with a memory mapping.
+ *
+ * cv::CascadeClassifier::load() parses the whole XML file (more than half a megabyte of text for
+ * haarcascade_frontalface_alt2.xml) every time a process starts. For short-lived workers that is most of their start
+ * up time. compileCascade() reads the XML once and writes everything the detector needs as plain arrays:
+ *
+ *	header     magic, version, window size, number of stages/trees/nodes/leaves/features and where each array starts
+ *	stages     first tree, number of trees and threshold of each stage
+ *	trees      first node and first leaf of each weak classifier
+ *	nodes      left, right, feature index and threshold of each decision node
+ *	leaves     leaf values
+ *	features   up to three weighted rectangles per Haar feature
+ *
+ * Every array starts on a 64-byte boundary. BinaryCascade::open() maps the file read-only and points straight into
+ * the mapping, so there is nothing to parse and nothing to copy, and all processes that open the same file share the
+ * same physical pages.
+ *
+ * Since cv::CascadeClassifier can only be loaded from XML/YAML, BinaryCascade has its own detectMultiScale() with the
+ * same parameters. It follows the same algorithm as OpenCV: the 20x20 window slides over a pyramid of down-scaled
+ * images, every window is normalized by its standard deviation and evaluated stage by stage (a window the first stage
+ * rejects skips the next one in its row, as in OpenCV), and the hits are merged with cv::groupRectangles(). Only
+ * BOOST cascades with upright HAAR features are supported.
+ */
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "../common/AtomicWrite.h"
+#include "../common/MappedFile.h"
+
+namespace binary_cascade
+{
+	constexpr char magic[8]{ 'H', 'A', 'A', 'R', 'B', 'I', 'N', '\0' };
+	constexpr std::uint32_t version{ 1 };
+	constexpr std::uint64_t alignment{ 64 };
+
+	struct Header
+	{
+		char magic[8];
+		std::uint32_t version;
+		std::int32_t windowWidth, windowHeight;
+		std::uint32_t stageCount, treeCount, nodeCount, leafCount, featureCount;
+		std::uint64_t stagesOffset, treesOffset, nodesOffset, leavesOffset, featuresOffset;
+		std::uint64_t fileSize;
+	};
+
+	struct Stage
+	{
+		std::int32_t firstTree, treeCount;
+		float threshold;
+		std::int32_t reserved;
+	};
+
+	struct Tree
+	{
+		std::int32_t firstNode, firstLeaf;
+	};
+
+	// A decision node. A child index <= 0 is a leaf: leaf number -index of the tree.
+	struct Node
+	{
+		std::int32_t left, right, featureIdx;
+		float threshold;
+	};
+
+	struct Rect
+	{
+		std::int32_t x, y, width, height;
+		float weight;
+	};
+
+	struct Feature
+	{
+		Rect rects[3];
+		std::int32_t rectCount;
+	};
+
+	inline std::uint64_t alignUp(std::uint64_t offset)
+	{
+		return (offset + alignment - 1) / alignment * alignment;
+	}
+}
+
+// Reads a cascade XML file and writes it in the binary layout described above. Returns false (and prints why) if
+// the file can't be read or uses features we don't support.
+inline bool compileCascade(const std::string& xmlPath, const std::string& binPath)
+{
+	using namespace binary_cascade;
+
+	cv::FileStorage fs{ xmlPath, cv::FileStorage::READ };
+	if (!fs.isOpened())
+	{
+		std::cerr << "Cannot open " << xmlPath << '\n';
+		return false;
+	}
+	cv::FileNode root{ fs["cascade"] };
+	if (static_cast<std::string>(root["stageType"]) != "BOOST" || static_cast<std::string>(root["featureType"]) != "HAAR")
+	{
+		std::cerr << xmlPath << " is not a BOOST cascade with HAAR features\n";
+		return false;
+	}
+
+	std::vector<Stage> stages;
+	std::vector<Tree> trees;
+	std::vector<Node> nodes;
+	std::vector<float> leaves;
+	std::vector<Feature> features;
+
+	for (const cv::FileNode& stageNode : root["stages"])
+	{
+		Stage stage{};
+		stage.firstTree = static_cast<std::int32_t>(trees.size());
+		// OpenCV subtracts the same epsilon when it loads a cascade, so rounding can't flip a decision.
+		stage.threshold = static_cast<float>(stageNode["stageThreshold"]) - 1e-5f;
+
+		for (const cv::FileNode& weak : stageNode["weakClassifiers"])
+		{
+			cv::FileNode internalNodes{ weak["internalNodes"] };
+			cv::FileNode leafValues{ weak["leafValues"] };
+			trees.push_back({ static_cast<std::int32_t>(nodes.size()), static_cast<std::int32_t>(leaves.size()) });
+
+			for (std::size_t i{ 0 }; i + 3 < internalNodes.size(); i += 4)
+			{
+				nodes.push_back({ static_cast<int>(internalNodes[static_cast<int>(i)]),
+					static_cast<int>(internalNodes[static_cast<int>(i + 1)]),
+					static_cast<int>(internalNodes[static_cast<int>(i + 2)]),
+					static_cast<float>(internalNodes[static_cast<int>(i + 3)]) });
+			}
+			for (std::size_t i{ 0 }; i < leafValues.size(); ++i)
+				leaves.push_back(static_cast<float>(leafValues[static_cast<int>(i)]));
+		}
+		stage.treeCount = static_cast<std::int32_t>(trees.size()) - stage.firstTree;
+		stages.push_back(stage);
+	}
+
+	for (const cv::FileNode& featureNode : root["features"])
+	{
+		if (static_cast<int>(featureNode["tilted"]) != 0)
+		{
+			std::cerr << xmlPath << " uses tilted features, which are not supported\n";
+			return false;
+		}
+		Feature feature{};
+		for (const cv::FileNode& rectNode : featureNode["rects"])
+		{
+			if (feature.rectCount == 3)
+				break;
+			Rect& r{ feature.rects[feature.rectCount++] };
+			r.x = static_cast<int>(rectNode[0]);
+			r.y = static_cast<int>(rectNode[1]);
+			r.width = static_cast<int>(rectNode[2]);
+			r.height = static_cast<int>(rectNode[3]);
+			r.weight = static_cast<float>(rectNode[4]);
+		}
+		features.push_back(feature);
+	}
+
+	Header header{};
+	std::memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	header.windowWidth = static_cast<int>(root["width"]);
+	header.windowHeight = static_cast<int>(root["height"]);
+	header.stageCount = static_cast<std::uint32_t>(stages.size());
+	header.treeCount = static_cast<std::uint32_t>(trees.size());
+	header.nodeCount = static_cast<std::uint32_t>(nodes.size());
+	header.leafCount = static_cast<std::uint32_t>(leaves.size());
+	header.featureCount = static_cast<std::uint32_t>(features.size());
+	header.stagesOffset = alignUp(sizeof(Header));
+	header.treesOffset = alignUp(header.stagesOffset + stages.size() * sizeof(Stage));
+	header.nodesOffset = alignUp(header.treesOffset + trees.size() * sizeof(Tree));
+	header.leavesOffset = alignUp(header.nodesOffset + nodes.size() * sizeof(Node));
+	header.featuresOffset = alignUp(header.leavesOffset + leaves.size() * sizeof(float));
+	header.fileSize = header.featuresOffset + features.size() * sizeof(Feature);
+
+	std::vector<char> file(header.fileSize, 0);
+	std::memcpy(file.data(), &header, sizeof(header));
+	std::memcpy(file.data() + header.stagesOffset, stages.data(), stages.size() * sizeof(Stage));
+	std::memcpy(file.data() + header.treesOffset, trees.data(), trees.size() * sizeof(Tree));
+	std::memcpy(file.data() + header.nodesOffset, nodes.data(), nodes.size() * sizeof(Node));
+	std::memcpy(file.data() + header.leavesOffset, leaves.data(), leaves.size() * sizeof(float));
+	std::memcpy(file.data() + header.featuresOffset, features.data(), features.size() * sizeof(Feature));
+
+	// A --binary reader may map the file at any moment, so it's written under a temporary name and renamed.
+	if (!writeFileAtomically(binPath, [&](std::ostream& out)
+		{
+			out.write(file.data(), static_cast<std::streamsize>(file.size()));
+		}))
+	{
+		std::cerr << "Cannot write " << binPath << '\n';
+		return false;
+	}
+	return true;
+}
+
+class BinaryCascade
+{
+public:
+	BinaryCascade() = default;
+
+	BinaryCascade(const BinaryCascade&) = delete;
+	BinaryCascade& operator=(const BinaryCascade&) = delete;
+
+	// Maps a file written by compileCascade(). Nothing is parsed or copied, but every array and every index into
+	// them is checked against the file size, so a damaged file is rejected instead of read out of bounds.
+	bool open(const std::string& path)
+	{
+		header_ = nullptr;
+		if (!file_.open(path))
+			return false;
+
+		const auto* header{ static_cast<const binary_cascade::Header*>(file_.data()) };
+		std::size_t size{ file_.size() };
+		if (size < sizeof(binary_cascade::Header) || std::memcmp(header->magic, binary_cascade::magic, 8) != 0 ||
+			header->version != binary_cascade::version || header->fileSize != size ||
+			!fits(header->stagesOffset, header->stageCount, sizeof(binary_cascade::Stage), size) ||
+			!fits(header->treesOffset, header->treeCount, sizeof(binary_cascade::Tree), size) ||
+			!fits(header->nodesOffset, header->nodeCount, sizeof(binary_cascade::Node), size) ||
+			!fits(header->leavesOffset, header->leafCount, sizeof(float), size) ||
+			!fits(header->featuresOffset, header->featureCount, sizeof(binary_cascade::Feature), size))
+		{
+			std::cerr << path << " is not a compiled cascade\n";
+			file_.close();
+			return false;
+		}
+
+		const char* base{ static_cast<const char*>(file_.data()) };
+		header_ = header;
+		stages_ = reinterpret_cast<const binary_cascade::Stage*>(base + header->stagesOffset);
+		trees_ = reinterpret_cast<const binary_cascade::Tree*>(base + header->treesOffset);
+		nodes_ = reinterpret_cast<const binary_cascade::Node*>(base + header->nodesOffset);
+		leaves_ = reinterpret_cast<const float*>(base + header->leavesOffset);
+		features_ = reinterpret_cast<const binary_cascade::Feature*>(base + header->featuresOffset);
+		if (!indicesValid())
+		{
+			std::cerr << path << " is a damaged compiled cascade\n";
+			header_ = nullptr;
+			file_.close();
+			return false;
+		}
+		return true;
+	}
+
+	bool empty() const { return header_ == nullptr; }
+
+	// Same parameters and results as cv::CascadeClassifier::detectMultiScale(). numDetections is the number of
+	// neighbors merged into each object.
+	void detectMultiScale(const cv::Mat& image, std::vector<cv::Rect>& objects, std::vector<int>& numDetections,
+		double scaleFactor = 1.1, int minNeighbors = 3, int flags = 0, cv::Size minSize = cv::Size(),
+		cv::Size maxSize = cv::Size()) const
+	{
+		(void)flags;
+		objects.clear();
+		numDetections.clear();
+		if (empty() || image.empty())
+			return;
+
+		cv::Mat gray;
+		if (image.channels() == 1)
+			gray = image;
+		else
+			cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+		if (maxSize.width <= 0 || maxSize.height <= 0)
+			maxSize = gray.size();
+
+		cv::Size window{ header_->windowWidth, header_->windowHeight };
+		cv::Mat scaled, sum, sqsum;
+		std::vector<OffsetFeature> offsets;
+		std::mutex candidatesMutex;
+
+		for (double factor{ 1.0 }; ; factor *= scaleFactor)
+		{
+			cv::Size windowSize{ cvRound(window.width * factor), cvRound(window.height * factor) };
+			cv::Size scaledSize{ cvRound(gray.cols / factor), cvRound(gray.rows / factor) };
+			if (windowSize.width > maxSize.width || windowSize.height > maxSize.height ||
+				scaledSize.width < window.width || scaledSize.height < window.height)
+				break;
+			if (windowSize.width < minSize.width || windowSize.height < minSize.height)
+				continue;
+
+			cv::resize(gray, scaled, scaledSize, 0, 0, cv::INTER_LINEAR);
+			cv::integral(scaled, sum, sqsum, CV_32S, CV_64F);
+			computeOffsets(static_cast<int>(sum.step1()), offsets);
+
+			// Small scales are searched every second pixel, like OpenCV does.
+			int step{ factor > 2.0 ? 1 : 2 };
+			int rows{ (scaledSize.height - window.height) / step + 1 };
+			cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range& range)
+				{
+					std::vector<cv::Rect> found;
+					for (int r{ range.start }; r < range.end; ++r)
+					{
+						int y{ r * step };
+						for (int x{ 0 }; x <= scaledSize.width - window.width; x += step)
+						{
+							int result{ evaluate(sum, sqsum, offsets, x, y) };
+							if (result > 0)
+								found.push_back(cv::Rect(cvRound(x * factor), cvRound(y * factor), windowSize.width,
+									windowSize.height));
+							// Like OpenCV: a window the first stage rejects skips its right neighbor too.
+							if (result == 0)
+								x += step;
+						}
+					}
+					std::lock_guard<std::mutex> lock{ candidatesMutex };
+					objects.insert(objects.end(), found.begin(), found.end());
+				});
+		}
+
+		if (minNeighbors > 0)
+			cv::groupRectangles(objects, numDetections, minNeighbors, 0.2);
+		else
+			numDetections.assign(objects.size(), 1);
+	}
+
+	void detectMultiScale(const cv::Mat& image, std::vector<cv::Rect>& objects, double scaleFactor = 1.1,
+		int minNeighbors = 3, int flags = 0, cv::Size minSize = cv::Size(), cv::Size maxSize = cv::Size()) const
+	{
+		std::vector<int> numDetections;
+		detectMultiScale(image, objects, numDetections, scaleFactor, minNeighbors, flags, minSize, maxSize);
+	}
+
+private:
+	// True if `count` elements of `elementSize` bytes, aligned as compileCascade() writes them, fit into the file at
+	// `offset`.
+	static bool fits(std::uint64_t offset, std::uint64_t count, std::size_t elementSize, std::size_t size)
+	{
+		return offset % binary_cascade::alignment == 0 && offset >= sizeof(binary_cascade::Header) &&
+			offset <= size && count <= (size - offset) / elementSize;
+	}
+
+	// Checks that every stage, tree, node and feature only refers to elements inside the arrays, that the trees can
+	// only be walked downwards (so evaluate() can't loop forever), and that the features lie inside the window.
+	bool indicesValid() const
+	{
+		using namespace binary_cascade;
+		const Header& h{ *header_ };
+		if (h.windowWidth <= 2 || h.windowHeight <= 2)
+			return false;
+
+		for (std::uint32_t si{ 0 }; si < h.stageCount; ++si)
+		{
+			const Stage& stage{ stages_[si] };
+			if (stage.firstTree < 0 || stage.treeCount < 0 ||
+				static_cast<std::uint64_t>(stage.firstTree) + stage.treeCount > h.treeCount)
+				return false;
+		}
+
+		for (std::uint32_t ti{ 0 }; ti < h.treeCount; ++ti)
+		{
+			const Tree& tree{ trees_[ti] };
+			if (tree.firstNode < 0 || static_cast<std::uint32_t>(tree.firstNode) >= h.nodeCount || tree.firstLeaf < 0)
+				return false;
+			// Walk every node reachable from the root. Children have larger indices than their parent.
+			std::vector<std::int32_t> pending{ 0 };
+			while (!pending.empty())
+			{
+				std::int32_t idx{ pending.back() };
+				pending.pop_back();
+				if (static_cast<std::uint64_t>(tree.firstNode) + idx >= h.nodeCount)
+					return false;
+				const Node& node{ nodes_[tree.firstNode + idx] };
+				if (node.featureIdx < 0 || static_cast<std::uint32_t>(node.featureIdx) >= h.featureCount)
+					return false;
+				for (std::int32_t child : { node.left, node.right })
+				{
+					if (child > 0 && child <= idx)
+						return false;
+					if (child > 0)
+						pending.push_back(child);
+					else if (static_cast<std::int64_t>(tree.firstLeaf) - child >= h.leafCount)
+						return false;
+				}
+			}
+		}
+
+		for (std::uint32_t fi{ 0 }; fi < h.featureCount; ++fi)
+		{
+			const Feature& feature{ features_[fi] };
+			if (feature.rectCount < 0 || feature.rectCount > 3)
+				return false;
+			for (int r{ 0 }; r < feature.rectCount; ++r)
+			{
+				const Rect& rect{ feature.rects[r] };
+				if (rect.x < 0 || rect.y < 0 || rect.width < 0 || rect.height < 0 ||
+					rect.x + rect.width > h.windowWidth || rect.y + rect.height > h.windowHeight)
+					return false;
+			}
+		}
+		return true;
+	}
+
+	// A feature with its rectangles turned into offsets in the integral image of the current scale.
+	struct OffsetFeature
+	{
+		int ofs[3][4];
+		float weight[3];
+		int rectCount;
+	};
+
+	void computeOffsets(int step, std::vector<OffsetFeature>& offsets) const
+	{
+		offsets.resize(header_->featureCount);
+		for (std::uint32_t i{ 0 }; i < header_->featureCount; ++i)
+		{
+			const binary_cascade::Feature& f{ features_[i] };
+			OffsetFeature& o{ offsets[i] };
+			o.rectCount = f.rectCount;
+			for (int r{ 0 }; r < f.rectCount; ++r)
+			{
+				const binary_cascade::Rect& rect{ f.rects[r] };
+				o.ofs[r][0] = rect.y * step + rect.x;
+				o.ofs[r][1] = rect.y * step + rect.x + rect.width;
+				o.ofs[r][2] = (rect.y + rect.height) * step + rect.x;
+				o.ofs[r][3] = (rect.y + rect.height) * step + rect.x + rect.width;
+				o.weight[r] = rect.weight;
+			}
+		}
+	}
+
+	// Runs the stages on the window with its top-left corner at (x, y). Returns what OpenCV's runAt() does: 1 if every
+	// stage accepts the window, -si if stage si rejects it (0 for the first stage), -1 for a flat window.
+	int evaluate(const cv::Mat& sum, const cv::Mat& sqsum, const std::vector<OffsetFeature>& offsets, int x,
+		int y) const
+	{
+		const int* p{ sum.ptr<int>(y) + x };
+		const double* pq{ sqsum.ptr<double>(y) + x };
+		int step{ static_cast<int>(sum.step1()) }, sqStep{ static_cast<int>(sqsum.step1()) };
+
+		// Normalize by the standard deviation of the window without its one-pixel frame, as OpenCV does.
+		int w{ header_->windowWidth - 2 }, h{ header_->windowHeight - 2 };
+		int a{ step + 1 }, b{ step + 1 + w }, c{ (h + 1) * step + 1 }, d{ (h + 1) * step + 1 + w };
+		int qa{ sqStep + 1 }, qb{ sqStep + 1 + w }, qc{ (h + 1) * sqStep + 1 }, qd{ (h + 1) * sqStep + 1 + w };
+		double valSum{ static_cast<double>(p[a] - p[b] - p[c] + p[d]) };
+		double valSqSum{ pq[qa] - pq[qb] - pq[qc] + pq[qd] };
+		double nf{ static_cast<double>(w) * h * valSqSum - valSum * valSum };
+		// OpenCV rejects flat and low-contrast windows before running any stage, so do we.
+		if (nf <= 0.0 || w * h / std::sqrt(nf) >= 0.1)
+			return -1;
+		double invNf{ 1.0 / std::sqrt(nf) };
+
+		for (std::uint32_t si{ 0 }; si < header_->stageCount; ++si)
+		{
+			const binary_cascade::Stage& stage{ stages_[si] };
+			double stageSum{ 0.0 };
+			for (int ti{ stage.firstTree }; ti < stage.firstTree + stage.treeCount; ++ti)
+			{
+				const binary_cascade::Tree& tree{ trees_[ti] };
+				int idx{ 0 };
+				do
+				{
+					const binary_cascade::Node& node{ nodes_[tree.firstNode + idx] };
+					const OffsetFeature& f{ offsets[node.featureIdx] };
+					float value{ 0.0f };
+					for (int r{ 0 }; r < f.rectCount; ++r)
+						value += f.weight[r] * static_cast<float>(p[f.ofs[r][0]] - p[f.ofs[r][1]] - p[f.ofs[r][2]] + p[f.ofs[r][3]]);
+					idx = value * invNf < node.threshold ? node.left : node.right;
+				} while (idx > 0);
+				stageSum += leaves_[tree.firstLeaf - idx];
+			}
+			if (stageSum < stage.threshold)
+				return -static_cast<int>(si);
+		}
+		return 1;
+	}
+
+	MappedFile file_;
+	const binary_cascade::Header* header_{ nullptr };
+	const binary_cascade::Stage* stages_{ nullptr };
+	const binary_cascade::Tree* trees_{ nullptr };
+	const binary_cascade::Node* nodes_{ nullptr };
+	const float* leaves_{ nullptr };
+	const binary_cascade::Feature* features_{ nullptr };
+};
@@ -40,13 +40,322 @@
  *	3. faces[i].br() gives the bottom right point.
  *	4. The fourth parameter is the scalar value of the color to be given to the rectangle.
  *	5. The fifth parameter is the thickness of the rectangle.
+ * The program doesn't call cv::rectangle() itself, but adds every face and a label over it to an AnnotationLayer
+ * from common/AnnotationLayer.h, which then draws them all in one pass, tile by tile on all cores:
+ *	AnnotationLayer layer{ img.size() };
+ *	layer.rectangle(faces[i], cv::Scalar(255, 0, 0), 2);
+ *	layer.text("face 1", faces[i].tl() + cv::Point(0, -6), cv::FONT_HERSHEY_SIMPLEX, 0.6, cv::Scalar(255, 0, 0), 2);
+ *	layer.render(img);
+ * In a video the layer is kept from frame to frame and clear()ed before the faces of the next frame are added, and
+ * each face is labelled with its number of neighbors.
+ *
+ * Detecting faces in a video
+ * detectMultiScale() searches the whole frame at every scale, which is far too slow to run on every frame of a
+ * stream. But a face moves only a little from one frame to the next, so we don't need to search the whole frame:
+ *	1. Every N frames (and whenever we lose a face) we run the full cascade over the whole frame.
+ *	2. In the frames between, we look for every known face again only inside its previous rectangle enlarged by
+ *	   half of its size, and only at scales close to its previous size. That is a tiny part of the work.
+ *	3. The cascade also tells us how many neighbors each detection had (numDetections), which we use as a
+ *	   confidence. If the local search doesn't find the face, or finds it with less than half of the neighbors of
+ *	   the full detection, the next frame runs the full cascade again.
+ * The frames are read in the same loop as in 02a_reading_videos and 02b_reading_from_webcam. At the end we print
+ * the effective frames per second of the detection and how many frames needed the full cascade.
+ *
+ * Loading the cascade faster
+ * faceCascade.load() parses the whole XML file every time the program starts, and for haarcascade_frontalface_alt2.xml
+ * that takes much longer than detecting the faces in one image. BinaryCascade.h compiles the cascade once into a
+ * binary file that holds the stages, trees, nodes, leaves and features as plain aligned arrays. Opening it only maps
+ * the file into memory (mmap), so there is nothing to parse, and every process that opens the same file shares one
+ * read-only copy of it. BinaryCascade has its own detectMultiScale() with the same parameters as the one of
+ * cv::CascadeClassifier:
+ *	compileCascade("../haarcascades/haarcascade_frontalface_alt2.xml", "../haarcascades/haarcascade_frontalface_alt2.bin");
+ *	BinaryCascade faceCascade;
+ *	faceCascade.open("../haarcascades/haarcascade_frontalface_alt2.bin");
+ *	faceCascade.detectMultiScale(imgGray, faces, 1.1, 3);
+ * --load-benchmark compares how long both ways of loading take and checks that both find the same faces.
+ *
+ * Hiding faces
+ * With --anonymize the faces are blurred instead of framed. blurRegions() from common/RegionBlur.h blurs only the
+ * face rectangles (plus the margin the blur needs), so the cost depends on the size of the faces, not of the image.
+ *
+ * Usage:
+ *	Source                                  detect faces in ../img/manchester.jpg
+ *	Source [--binary] --anonymize           blur the faces found in ../img/manchester.jpg
+ *	Source --video [file|camera] [--every N]  detect faces in a video or camera stream (default: camera 0, N = 10)
+ *	Source --compile [xml] [bin]            compile a cascade to the binary format (default: the alt2 cascade)
+ *	Source --binary [--video ...]           same as above, with the compiled cascade
+ *	Source --load-benchmark                 time loading the XML cascade against opening the compiled one
  */
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <cstdlib>
+#include <iostream>
+#include <optional>
 #include <string>
 #include <vector>
 #include <opencv2/opencv.hpp>
+#include "BinaryCascade.h"
+#include "../common/AnnotationLayer.h"
+#include "../common/RegionBlur.h"
+
+const std::string xmlCascadePath{ "../haarcascades/haarcascade_frontalface_alt2.xml" };
+const std::string binCascadePath{ "../haarcascades/haarcascade_frontalface_alt2.bin" };
+
+// A face followed from frame to frame.
+struct TrackedFace
+{
+	cv::Rect box;
+	// Number of neighbors the full cascade found for it, our measure of confidence.
+	int confidence;
+};
+
+// Looks for the face again in a window around its last position. Returns false if it's gone or the detection is
+// much weaker than the one from the full cascade. Works with cv::CascadeClassifier and BinaryCascade.
+template <typename Cascade>
+bool redetect(Cascade& cascade, const cv::Mat& gray, TrackedFace& face)
+{
+	cv::Rect window{ face.box.x - face.box.width / 2, face.box.y - face.box.height / 2, face.box.width * 2,
+		face.box.height * 2 };
+	window &= cv::Rect(0, 0, gray.cols, gray.rows);
+	if (window.empty())
+		return false;
+
+	std::vector<cv::Rect> found;
+	std::vector<int> neighbors;
+	cv::Size minSize{ face.box.width * 7 / 10, face.box.height * 7 / 10 };
+	cv::Size maxSize{ face.box.width * 14 / 10, face.box.height * 14 / 10 };
+	cascade.detectMultiScale(gray(window), found, neighbors, 1.1, 3, 0, minSize, maxSize);
+	if (found.empty())
+		return false;
+
+	// Take the detection closest to where the face was.
+	cv::Point center{ face.box.x + face.box.width / 2 - window.x, face.box.y + face.box.height / 2 - window.y };
+	std::size_t best{ 0 };
+	double bestDistance{ -1 };
+	for (std::size_t i{ 0 }; i < found.size(); ++i)
+	{
+		cv::Point c{ found[i].x + found[i].width / 2, found[i].y + found[i].height / 2 };
+		double distance{ cv::norm(c - center) };
+		if (bestDistance < 0 || distance < bestDistance)
+		{
+			best = i;
+			bestDistance = distance;
+		}
+	}
 
-int main()
+	face.box = found[best] + window.tl();
+	return neighbors[best] * 2 >= face.confidence;
+}
+
+template <typename Cascade>
+int runVideo(Cascade& faceCascade, int argc, char** argv, int first)
 {
+	std::string source{ "0" };
+	int every{ 10 };
+	for (int i{ first }; i < argc; ++i)
+	{
+		std::string arg{ argv[i] };
+		if (arg == "--every" && i + 1 < argc)
+			every = std::max(1, std::atoi(argv[++i]));
+		else
+			source = arg;
+	}
+
+	// A plain number is a camera index, anything else is a path to a video file.
+	cv::VideoCapture cap;
+	if (std::all_of(source.begin(), source.end(), [](unsigned char c) { return std::isdigit(c); }))
+		cap.open(std::atoi(source.c_str()));
+	else
+		cap.open(source);
+	if (!cap.isOpened())
+	{
+		std::cerr << "Cannot open " << source << '\n';
+		return 1;
+	}
+
+	cv::Mat frame, gray;
+	std::vector<TrackedFace> faces;
+	std::vector<cv::Rect> found;
+	std::vector<int> neighbors;
+	std::optional<AnnotationLayer> layer;
+	bool needFull{ true };
+	int frames{ 0 }, fullCalls{ 0 }, localCalls{ 0 };
+	double detectSeconds{ 0 };
+
+	while (cap.read(frame) && !frame.empty())
+	{
+		auto start{ std::chrono::steady_clock::now() };
+		cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+
+		if (needFull || frames % every == 0)
+		{
+			faceCascade.detectMultiScale(gray, found, neighbors, 1.1, 3);
+			faces.clear();
+			for (std::size_t i{ 0 }; i < found.size(); ++i)
+				faces.push_back({ found[i], neighbors[i] });
+			++fullCalls;
+			needFull = false;
+		}
+		else
+		{
+			// Keep the faces we found again. Losing one (or a weak match) means the next frame gets the full
+			// cascade, which also picks up faces that entered the frame in the meantime.
+			std::size_t kept{ 0 };
+			for (std::size_t i{ 0 }; i < faces.size(); ++i)
+			{
+				++localCalls;
+				if (!redetect(faceCascade, gray, faces[i]))
+				{
+					needFull = true;
+					continue;
+				}
+				if (kept != i)
+					faces[kept] = faces[i];
+				++kept;
+			}
+			faces.erase(faces.begin() + static_cast<std::ptrdiff_t>(kept), faces.end());
+		}
+
+		detectSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		++frames;
+
+		// The frames of a stream all have the same size, so one layer is made for the first and cleared for each.
+		if (!layer)
+			layer.emplace(frame.size());
+		layer->clear();
+		for (const auto& f : faces)
+		{
+			layer->rectangle(f.box, cv::Scalar(255, 0, 0), 2);
+			layer->text(std::to_string(f.confidence), f.box.tl() + cv::Point(0, -6), cv::FONT_HERSHEY_SIMPLEX, 0.6,
+				cv::Scalar(255, 0, 0), 2);
+		}
+		layer->render(frame);
+		cv::imshow("FaceDetection", frame);
+
+		int key{ cv::waitKey(1) };
+		if (key == 'q')
+			break;
+	}
+
+	cap.release();
+	cv::destroyAllWindows();
+
+	if (frames == 0)
+		return 0;
+	std::cout << "Frames: " << frames << ", full cascade: " << fullCalls << " (" << 100.0 * fullCalls / frames
+		<< "% of frames), local searches: " << localCalls << '\n';
+	std::cout << "Effective detection fps: " << frames / detectSeconds << '\n';
+
+	return 0;
+}
+
+// Number of faces in `faces` that overlap one in `others` by more than half of their area.
+int countMatched(const std::vector<cv::Rect>& faces, const std::vector<cv::Rect>& others)
+{
+	int matched{ 0 };
+	for (const auto& a : faces)
+	{
+		for (const auto& b : others)
+		{
+			if ((a & b).area() * 2 > a.area())
+			{
+				++matched;
+				break;
+			}
+		}
+	}
+	return matched;
+}
+
+int runLoadBenchmark()
+{
+	if (!compileCascade(xmlCascadePath, binCascadePath))
+		return 1;
+
+	const int runs{ 20 };
+	double xmlMs{ 0 }, binMs{ 0 };
+	for (int i{ 0 }; i < runs; ++i)
+	{
+		auto start{ std::chrono::steady_clock::now() };
+		cv::CascadeClassifier xmlCascade;
+		xmlCascade.load(xmlCascadePath);
+		auto middle{ std::chrono::steady_clock::now() };
+		BinaryCascade binCascade;
+		binCascade.open(binCascadePath);
+		auto end{ std::chrono::steady_clock::now() };
+		xmlMs += std::chrono::duration<double, std::milli>(middle - start).count();
+		binMs += std::chrono::duration<double, std::milli>(end - middle).count();
+	}
+	xmlMs /= runs;
+	binMs /= runs;
+	std::cout << "XML load: " << xmlMs << " ms, binary open: " << binMs << " ms (" << xmlMs / binMs << "x faster)\n";
+
+	// Both must find the same faces.
+	cv::Mat img{ cv::imread("../img/manchester.jpg") };
+	if (img.empty())
+		return 0;
+	cv::Mat imgGray;
+	cv::cvtColor(img, imgGray, cv::COLOR_BGR2GRAY);
+
+	cv::CascadeClassifier xmlCascade;
+	xmlCascade.load(xmlCascadePath);
+	BinaryCascade binCascade;
+	binCascade.open(binCascadePath);
+	std::vector<cv::Rect> xmlFaces, binFaces;
+	auto start{ std::chrono::steady_clock::now() };
+	xmlCascade.detectMultiScale(imgGray, xmlFaces, 1.1, 3);
+	auto middle{ std::chrono::steady_clock::now() };
+	binCascade.detectMultiScale(imgGray, binFaces, 1.1, 3);
+	auto end{ std::chrono::steady_clock::now() };
+
+	// Checked both ways: every XML face needs a binary match, and every binary face an XML one.
+	int xmlMatched{ countMatched(xmlFaces, binFaces) }, binMatched{ countMatched(binFaces, xmlFaces) };
+	std::cout << "Faces with XML cascade: " << xmlFaces.size() << " in "
+		<< std::chrono::duration<double, std::milli>(middle - start).count() << " ms, with binary cascade: "
+		<< binFaces.size() << " in " << std::chrono::duration<double, std::milli>(end - middle).count() << " ms\n";
+	bool same{ xmlMatched == static_cast<int>(xmlFaces.size()) && binMatched == static_cast<int>(binFaces.size()) };
+	std::cout << "XML faces found by the binary cascade: " << xmlMatched << '/' << xmlFaces.size()
+		<< ", binary faces found by the XML cascade: " << binMatched << '/' << binFaces.size() << " -> "
+		<< (same ? "same detections" : "DIFFERENT detections") << '\n';
+	return same ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+	std::string mode{ argc > 1 ? argv[1] : "" };
+	if (mode == "--compile")
+	{
+		std::string xml{ argc > 2 ? argv[2] : xmlCascadePath };
+		std::string bin{ argc > 3 ? argv[3] : binCascadePath };
+		return compileCascade(xml, bin) ? 0 : 1;
+	}
+	if (mode == "--load-benchmark")
+		return runLoadBenchmark();
+
+	bool binary{ mode == "--binary" };
+	int first{ binary ? 2 : 1 };
+	BinaryCascade binCascade;
+	if (binary && !binCascade.open(binCascadePath))
+	{
+		std::cerr << "Cannot open " << binCascadePath << ", run with --compile first\n";
+		return 1;
+	}
+
+	if (argc > first && std::string{ argv[first] } == "--video")
+	{
+		if (binary)
+			return runVideo(binCascade, argc, argv, first + 1);
+
+		cv::CascadeClassifier xmlCascade;
+		if (!xmlCascade.load(xmlCascadePath))
+		{
+			std::cerr << "Cannot load the cascade\n";
+			return 1;
+		}
+		return runVideo(xmlCascade, argc, argv, first + 1);
+	}
+
 	// Load image from disk
 	cv::Mat img{ cv::imread("../img/manchester.jpg") };
 
@@ -54,13 +363,23 @@ int main()
 	cv::Mat imgGray;
 	cv::cvtColor(img, imgGray, cv::COLOR_BGR2GRAY);
 
-	// Load cascade classifier
-	cv::CascadeClassifier faceCascade;
-	faceCascade.load("../haarcascades/haarcascade_frontalface_alt2.xml");
-
-	// Find faces
+	// Find faces (with the compiled cascade if asked to)
 	std::vector<cv::Rect> faces;
-	faceCascade.detectMultiScale(img, faces, 1.1, 3);
+	if (binary)
+	{
+		binCascade.detectMultiScale(imgGray, faces, 1.1, 3);
+	}
+	else
+	{
+		// Load cascade classifier
+		cv::CascadeClassifier faceCascade;
+		faceCascade.load(xmlCascadePath);
+		faceCascade.detectMultiScale(img, faces, 1.1, 3);
+	}
+
+	bool anonymize{ argc > first && std::string{ argv[first] } == "--anonymize" };
+	if (anonymize)
+		blurRegions(img, faces, 51);
 
 	// Draw rectangles on detected faces (uncomment one of for loop and comment another)
 
@@ -68,9 +387,18 @@ int main()
 	//for (int i{ 0 }; i < faces.size(); ++i)
 	//	cv::rectangle(img, faces[i].tl(), faces[i].br(), cv::Scalar(255, 0, 0), 2); 
 
-	// New better loop - range-based for loop
-	for (const auto& f : faces)
-		cv::rectangle(img, f.tl(), f.br(), cv::Scalar(255, 0, 0), 2);
+	// Through an AnnotationLayer, with the number of each face as its label
+	if (!anonymize)
+	{
+		AnnotationLayer layer{ img.size() };
+		for (std::size_t i{ 0 }; i < faces.size(); ++i)
+		{
+			layer.rectangle(faces[i], cv::Scalar(255, 0, 0), 2);
+			layer.text("face " + std::to_string(i + 1), faces[i].tl() + cv::Point(0, -6), cv::FONT_HERSHEY_SIMPLEX, 0.6,
+				cv::Scalar(255, 0, 0), 2);
+		}
+		layer.render(img);
+	}
 
 	// Show image with contours
 	std::string windowName{ "FaceDetection" };
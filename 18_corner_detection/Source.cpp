@@ -55,12 +55,255 @@
  *
  * Note: The cornerHarris() function can be sensitive to noise and might produce false positive, so we recommend
  * using additional techniques to verify the detected corners, such non-maximum suppression.
+ *
+ * Extracting corners with non-maximum suppression
+ * The loop above has two problems. Every pixel of a corner "blob" is above the threshold, so we draw thousands of
+ * overlapping circles for a few hundred real corners, and the at<float>() calls check the bounds for every pixel.
+ * extractCorners() walks the raw Harris response once and returns a compact list of corners:
+ *	std::vector<Corner> corners = extractCorners(output, threshold, nmsSize, topK);
+ *	1. output is the Harris response (CV_32FC1). We don't need the normalized copy any more; minMaxLoc() gives us
+ *	   the minimum and maximum, and from them the raw value that corresponds to 100 after normalization.
+ *	2. threshold is the smallest response that can be a corner.
+ *	3. nmsSize is the size of the non-maximum suppression window. A pixel is only a corner if it's the largest value
+ *	   in the nmsSize x nmsSize window around it.
+ *	4. topK keeps only the K strongest corners (0 keeps all of them).
+ * The threshold test runs on 16 pixels at a time with SIMD instructions (OpenCV's universal intrinsics), so the
+ * large areas of the image without corners are skipped quickly. Only the few pixels above the threshold go through
+ * the window comparison. drawCorners() then marks every corner with a circle.
+ *
+ * Tiled Harris for very large images
+ * cornerHarris() needs a float response as big as the whole image, and normalize() makes a second one. For a 100 MP
+ * aerial photo that is 800 MB on top of the image, computed on a single core. tiledHarrisCorners() splits the
+ * image into tiles and processes them in parallel with cv::parallel_for_():
+ *	1. Each tile is computed together with a halo of extra pixels around it, wide enough for the Sobel and box
+ *	   filters inside cornerHarris() and for the non-maximum suppression window. So the response and the local
+ *	   maxima near the tile edges are exactly the same as for the whole image.
+ *	2. The first pass only keeps the minimum and maximum of every tile and reduces them to the global range.
+ *	3. The second pass computes the tiles again and keeps the local maxima above the threshold from that range.
+ * Computing the response twice costs extra time, but in exchange the memory use depends only on the tile size and
+ * the number of threads, not on the size of the image.
+ *
+ * Drawing many shapes
+ * Drawing every corner with its own cv::circle() call walks the image once per circle on one core. drawCorners()
+ * collects the circles in an AnnotationLayer (common/AnnotationLayer.h) instead, which sorts them into tiles and draws
+ * all tiles in parallel, each while it's in the cache. We also time the thousands of circles of the per-pixel loop
+ * drawn both ways.
+ *
+ * Usage:
+ *	Source [--nms N] [--top K] [--tile N]
+ * The program times the old per-pixel loop against extractCorners() on the same response and prints both. It also
+ * runs tiledHarrisCorners() and checks that it finds the same corners.
 */
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
 #include <string>
+#include <vector>
 #include <opencv2/opencv.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include "../common/AnnotationLayer.h"
+
+// A corner found by extractCorners(): its position and its Harris response.
+struct Corner
+{
+	cv::Point pt;
+	float response;
+};
+
+// True if the value at (x, y) is the largest in the window of radius r around it. On a plateau of equal values only
+// the first pixel (in reading order) counts, so flat maxima give one corner instead of several.
+bool isLocalMax(const cv::Mat& response, int y, int x, int r)
+{
+	float value{ response.ptr<float>(y)[x] };
+	int y0{ std::max(0, y - r) }, y1{ std::min(response.rows - 1, y + r) };
+	int x0{ std::max(0, x - r) }, x1{ std::min(response.cols - 1, x + r) };
 
-int main()
+	for (int ny{ y0 }; ny <= y1; ++ny)
+	{
+		const float* row{ response.ptr<float>(ny) };
+		for (int nx{ x0 }; nx <= x1; ++nx)
+		{
+			if (row[nx] > value || (row[nx] == value && (ny < y || (ny == y && nx < x))))
+				return false;
+		}
+	}
+	return true;
+}
+
+// Appends the local maxima above the threshold inside `area` of the response. The suppression window may reach
+// outside `area` (but not outside the response), and `offset` is added to the positions that are stored.
+void appendCorners(const cv::Mat& response, cv::Rect area, float threshold, int r, cv::Point offset,
+	std::vector<Corner>& corners)
 {
+	int xEnd{ area.x + area.width };
+	for (int y{ area.y }; y < area.y + area.height; ++y)
+	{
+		const float* row{ response.ptr<float>(y) };
+		int x{ area.x };
+#if CV_SIMD128
+		// Skip blocks of 16 pixels that are all below the threshold.
+		for (; x + 16 <= xEnd; x += 16)
+		{
+			cv::v_float32x4 blockMax{ cv::v_max(cv::v_max(cv::v_load(row + x), cv::v_load(row + x + 4)),
+				cv::v_max(cv::v_load(row + x + 8), cv::v_load(row + x + 12))) };
+			if (cv::v_reduce_max(blockMax) <= threshold)
+				continue;
+
+			for (int i{ x }; i < x + 16; ++i)
+			{
+				if (row[i] > threshold && isLocalMax(response, y, i, r))
+					corners.push_back({ cv::Point(i, y) + offset, row[i] });
+			}
+		}
+#endif
+		for (; x < xEnd; ++x)
+		{
+			if (row[x] > threshold && isLocalMax(response, y, x, r))
+				corners.push_back({ cv::Point(x, y) + offset, row[x] });
+		}
+	}
+}
+
+// Keeps the K strongest corners, strongest first. Does nothing if topK is 0.
+void keepStrongest(std::vector<Corner>& corners, int topK)
+{
+	if (topK > 0 && static_cast<int>(corners.size()) > topK)
+	{
+		std::partial_sort(corners.begin(), corners.begin() + topK, corners.end(),
+			[](const Corner& a, const Corner& b) { return a.response > b.response; });
+		corners.resize(topK);
+	}
+}
+
+// Returns the local maxima of the response that are above the threshold, strongest first if topK > 0.
+std::vector<Corner> extractCorners(const cv::Mat& response, float threshold, int nmsSize = 3, int topK = 0)
+{
+	CV_Assert(response.type() == CV_32FC1);
+	std::vector<Corner> corners;
+	appendCorners(response, cv::Rect(0, 0, response.cols, response.rows), threshold, std::max(1, nmsSize / 2),
+		cv::Point(0, 0), corners);
+	keepStrongest(corners, topK);
+	return corners;
+}
+
+// Harris corners of a (very large) image, computed tile by tile on all cores. Gives the same corners as
+// cornerHarris + minMaxLoc + extractCorners on the whole image, but never holds more than one tile of response per
+// thread. `level` is the threshold relative to the response range, 101 / 255 matches "normalized value above 100".
+std::vector<Corner> tiledHarrisCorners(const cv::Mat& gray, int blockSize, int ksize, double k, double level,
+	int nmsSize = 3, int topK = 0, int tileSize = 512)
+{
+	int r{ std::max(1, nmsSize / 2) };
+	// The response of a pixel depends on the pixels within blockSize / 2 (box filter) + ksize / 2 (Sobel) of it.
+	int harrisHalo{ blockSize / 2 + ksize / 2 + 1 };
+	cv::Rect bounds{ 0, 0, gray.cols, gray.rows };
+
+	std::vector<cv::Rect> tiles;
+	for (int y{ 0 }; y < gray.rows; y += tileSize)
+	{
+		for (int x{ 0 }; x < gray.cols; x += tileSize)
+			tiles.push_back(cv::Rect(x, y, tileSize, tileSize) & bounds);
+	}
+
+	// Computes the response for a tile plus its halo. `inner` is where the tile itself lies in `response`.
+	auto tileResponse{ [&](const cv::Rect& tile, cv::Mat& response, cv::Rect& inner, cv::Point& origin)
+		{
+			int halo{ r + harrisHalo };
+			cv::Rect input{ cv::Rect(tile.x - halo, tile.y - halo, tile.width + 2 * halo, tile.height + 2 * halo) & bounds };
+			cv::cornerHarris(gray(input), response, blockSize, ksize, k);
+			origin = input.tl();
+			inner = tile - origin;
+		} };
+
+	// Pass 1: reduce the minimum and maximum of the response over all tiles.
+	std::vector<double> tileMin(tiles.size()), tileMax(tiles.size());
+	cv::parallel_for_(cv::Range(0, static_cast<int>(tiles.size())), [&](const cv::Range& range)
+		{
+			cv::Mat response;
+			cv::Rect inner;
+			cv::Point origin;
+			for (int i{ range.start }; i < range.end; ++i)
+			{
+				tileResponse(tiles[i], response, inner, origin);
+				cv::minMaxLoc(response(inner), &tileMin[i], &tileMax[i]);
+			}
+		});
+	double minVal{ *std::min_element(tileMin.begin(), tileMin.end()) };
+	double maxVal{ *std::max_element(tileMax.begin(), tileMax.end()) };
+	float threshold{ static_cast<float>(minVal + (maxVal - minVal) * level) };
+
+	// Pass 2: compute each tile again and keep only its local maxima above the global threshold.
+	std::vector<std::vector<Corner>> tileCorners(tiles.size());
+	cv::parallel_for_(cv::Range(0, static_cast<int>(tiles.size())), [&](const cv::Range& range)
+		{
+			cv::Mat response;
+			cv::Rect inner;
+			cv::Point origin;
+			for (int i{ range.start }; i < range.end; ++i)
+			{
+				tileResponse(tiles[i], response, inner, origin);
+				appendCorners(response, inner, threshold, r, origin, tileCorners[i]);
+				keepStrongest(tileCorners[i], topK);
+			}
+		});
+
+	std::vector<Corner> corners;
+	for (const auto& tc : tileCorners)
+		corners.insert(corners.end(), tc.begin(), tc.end());
+	if (topK > 0)
+		keepStrongest(corners, topK);
+	else
+		std::sort(corners.begin(), corners.end(), [](const Corner& a, const Corner& b)
+			{ return a.pt.y != b.pt.y ? a.pt.y < b.pt.y : a.pt.x < b.pt.x; });
+	return corners;
+}
+
+// Draws a circle around every corner (see "Drawing many shapes" above for how).
+void drawCorners(cv::Mat& image, const std::vector<Corner>& corners)
+{
+	AnnotationLayer layer{ image.size() };
+	for (const auto& c : corners)
+		layer.circle(c.pt, 4, cv::Scalar(0, 0, 255), 2);
+	layer.render(image);
+}
+
+// Times drawing a circle around every point with cv::circle() against an AnnotationLayer.
+void benchmarkDrawing(const cv::Mat& image, const std::vector<cv::Point>& points)
+{
+	cv::Mat direct{ image.clone() }, layered{ image.clone() };
+	auto start{ std::chrono::steady_clock::now() };
+	for (const auto& p : points)
+		cv::circle(direct, p, 4, cv::Scalar(0, 0, 255), 2);
+	auto middle{ std::chrono::steady_clock::now() };
+	AnnotationLayer layer{ image.size() };
+	for (const auto& p : points)
+		layer.circle(p, 4, cv::Scalar(0, 0, 255), 2);
+	layer.render(layered);
+	auto end{ std::chrono::steady_clock::now() };
+
+	cv::Mat difference;
+	cv::absdiff(direct, layered, difference);
+	std::cout << "Drawing " << points.size() << " circles: cv::circle " << std::chrono::duration<double, std::milli>(
+		middle - start).count() << " ms, AnnotationLayer " << std::chrono::duration<double, std::milli>(end - middle).count()
+		<< " ms, different pixels: " << cv::countNonZero(difference.reshape(1)) << '\n';
+}
+
+int main(int argc, char** argv)
+{
+	int nmsSize{ 3 };
+	int topK{ 0 };
+	int tileSize{ 512 };
+	for (int i{ 1 }; i + 1 < argc; i += 2)
+	{
+		std::string option{ argv[i] };
+		if (option == "--tile")
+			tileSize = std::max(16, std::atoi(argv[i + 1]));
+		else if (option == "--nms")
+			nmsSize = std::max(1, std::atoi(argv[i + 1]));
+		else if (option == "--top")
+			topK = std::max(0, std::atoi(argv[i + 1]));
+	}
+
 	// Declaring necessary matrices
 	cv::Mat image, gray;
 	cv::Mat output, output_norm, output_norm_scaled;
@@ -74,7 +317,11 @@ int main()
 	// Detecting corners
 	cv::cornerHarris(gray, output, 6, 3, 0.1);
 
-	// Normalize the values
+	// Old way: normalize the values and draw a circle around every pixel above 100 (on a copy, for comparison)
+	auto start{ std::chrono::steady_clock::now() };
+	cv::Mat perPixelImage{ image.clone() };
+	int circles{ 0 };
+	std::vector<cv::Point> circleCenters;
 	cv::normalize(output, output_norm, 0, 255, cv::NORM_MINMAX, CV_32FC1, cv::Mat());
 	cv::convertScaleAbs(output_norm, output_norm_scaled);
 
@@ -84,9 +331,42 @@ int main()
 		for(int i{0}; i < output.cols; ++i)
 		{
 			if (static_cast<int>(output_norm.at<float>(j, i)) > 100)
-				cv::circle(image, cv::Point(i, j), 4, cv::Scalar(0, 0, 255), 2);
+			{
+				cv::circle(perPixelImage, cv::Point(i, j), 4, cv::Scalar(0, 0, 255), 2);
+				circleCenters.emplace_back(i, j);
+				++circles;
+			}
 		}
 	}
+	auto middle{ std::chrono::steady_clock::now() };
+
+	// New way: find the raw value that normalizes to 100, keep only local maxima above it and draw them
+	double minVal, maxVal;
+	cv::minMaxLoc(output, &minVal, &maxVal);
+	float threshold{ static_cast<float>(minVal + (maxVal - minVal) * 101.0 / 255.0) };
+	std::vector<Corner> corners{ extractCorners(output, threshold, nmsSize, topK) };
+	drawCorners(image, corners);
+	auto end{ std::chrono::steady_clock::now() };
+
+	std::cout << "Per-pixel loop:  " << std::chrono::duration<double, std::milli>(middle - start).count() << " ms, "
+		<< circles << " circles\n";
+	std::cout << "extractCorners:  " << std::chrono::duration<double, std::milli>(end - middle).count() << " ms, "
+		<< corners.size() << " corners (" << nmsSize << "x" << nmsSize << " NMS"
+		<< (topK > 0 ? ", top " + std::to_string(topK) : std::string{}) << ")\n";
+
+	// The circles of the per-pixel loop, drawn one by one and through an AnnotationLayer
+	benchmarkDrawing(image, circleCenters);
+
+	// Tiled: cornerHarris, the min/max reduction and the extraction, tile by tile on all cores
+	auto tiledStart{ std::chrono::steady_clock::now() };
+	std::vector<Corner> tiledCorners{ tiledHarrisCorners(gray, 6, 3, 0.1, 101.0 / 255.0, nmsSize, topK, tileSize) };
+	auto tiledEnd{ std::chrono::steady_clock::now() };
+
+	bool same{ tiledCorners.size() == corners.size() && std::equal(corners.begin(), corners.end(),
+		tiledCorners.begin(), [](const Corner& a, const Corner& b) { return a.pt == b.pt; }) };
+	std::cout << "Tiled (" << tileSize << " px, " << cv::getNumThreads() << " threads): "
+		<< std::chrono::duration<double, std::milli>(tiledEnd - tiledStart).count() << " ms including cornerHarris, "
+		<< tiledCorners.size() << " corners, " << (same ? "same as" : "DIFFERENT from") << " the whole-image result\n";
 
 	// Display image
 	std::string name{ "Output Harris" };
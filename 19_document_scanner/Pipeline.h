@@ -0,0 +1,160 @@
+/*
+ * Small building blocks for running the scanner as a multi-threaded pipeline.
+ *
+ * BoundedQueue
+ * A fixed-capacity queue shared between two pipeline stages. push() blocks while the queue is full and pop() blocks
+ * while it's empty, so a slow stage slows down the stages in front of it instead of letting work pile up in memory.
+ * Once close() is called, pop() drains what is left and then returns an empty std::optional.
+ *
+ * Semaphore
+ * Counts how many images are inside the pipeline at once. The reader acquires a token before decoding an image and
+ * the last stage releases it, so the number of in-flight images never exceeds the limit we choose.
+ *
+ * StageStats
+ * Accumulates busy time and item count for a single named stage. Stages run on several threads at once, so the
+ * counters are atomics.
+ *
+ * startStage
+ * Starts a group of worker threads between two queues. The last worker of a group to finish closes the output queue,
+ * so closing the first queue shuts the whole pipeline down in order.
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+template <typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(std::size_t capacity) : capacity_{ capacity > 0 ? capacity : 1 } {}
+
+	// Returns false if the queue was closed and the item was not accepted.
+	bool push(T item)
+	{
+		std::unique_lock<std::mutex> lock{ mutex_ };
+		notFull_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+		if (closed_)
+			return false;
+		items_.push_back(std::move(item));
+		notEmpty_.notify_one();
+		return true;
+	}
+
+	// Returns an empty optional once the queue is closed and drained.
+	std::optional<T> pop()
+	{
+		std::unique_lock<std::mutex> lock{ mutex_ };
+		notEmpty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+		if (items_.empty())
+			return std::nullopt;
+		T item{ std::move(items_.front()) };
+		items_.pop_front();
+		notFull_.notify_one();
+		return item;
+	}
+
+	void close()
+	{
+		std::lock_guard<std::mutex> lock{ mutex_ };
+		closed_ = true;
+		notEmpty_.notify_all();
+		notFull_.notify_all();
+	}
+
+private:
+	std::size_t capacity_;
+	std::deque<T> items_;
+	bool closed_{ false };
+	std::mutex mutex_;
+	std::condition_variable notEmpty_, notFull_;
+};
+
+class Semaphore
+{
+public:
+	explicit Semaphore(int count) : count_{ count } {}
+
+	void acquire()
+	{
+		std::unique_lock<std::mutex> lock{ mutex_ };
+		available_.wait(lock, [this] { return count_ > 0; });
+		--count_;
+	}
+
+	void release()
+	{
+		std::lock_guard<std::mutex> lock{ mutex_ };
+		++count_;
+		available_.notify_one();
+	}
+
+private:
+	int count_;
+	std::mutex mutex_;
+	std::condition_variable available_;
+};
+
+struct StageStats
+{
+	explicit StageStats(std::string stageName) : name{ std::move(stageName) } {}
+
+	void add(std::chrono::steady_clock::duration busy)
+	{
+		busyNs += std::chrono::duration_cast<std::chrono::nanoseconds>(busy).count();
+		++items;
+	}
+
+	double busyMs() const { return static_cast<double>(busyNs.load()) / 1e6; }
+	double msPerItem() const { return items > 0 ? busyMs() / static_cast<double>(items.load()) : 0.0; }
+
+	std::string name;
+	std::atomic<std::int64_t> busyNs{ 0 };
+	std::atomic<std::int64_t> items{ 0 };
+};
+
+// Measures the time spent in the enclosing scope and adds it to a stage.
+class StageTimer
+{
+public:
+	explicit StageTimer(StageStats& stats) : stats_{ stats }, start_{ std::chrono::steady_clock::now() } {}
+	~StageTimer() { stats_.add(std::chrono::steady_clock::now() - start_); }
+
+	StageTimer(const StageTimer&) = delete;
+	StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+	StageStats& stats_;
+	std::chrono::steady_clock::time_point start_;
+};
+
+// Starts `count` threads that pop items from `in`, run `work(item, worker)` on them and push the result to `out` (if
+// any). `worker` is the index of the thread inside the group, so a stage can give each thread its own state. `work`
+// returns false to drop an item instead of passing it on.
+template <typename T, typename Work>
+void startStage(std::vector<std::thread>& threads, int count, BoundedQueue<T>& in, BoundedQueue<T>* out, Work work)
+{
+	auto remaining{ std::make_shared<std::atomic<int>>(count) };
+	for (int i{ 0 }; i < count; ++i)
+	{
+		threads.emplace_back([&in, out, work, remaining, i]() mutable
+			{
+				while (std::optional<T> item{ in.pop() })
+				{
+					if (work(*item, i) && out)
+						out->push(std::move(*item));
+				}
+				if (--*remaining == 0 && out)
+					out->close();
+			});
+	}
+}
@@ -0,0 +1,132 @@
+/*
+ * Following a document quad from one video frame to the next.
+ *
+ * Finding the document from scratch needs Canny, dilate, findContours and approxPolyDP over the whole frame. In a
+ * video the document barely moves between two frames, so most of the time it's enough to check where the four
+ * corners went:
+ *	1. The corners from the previous frame are followed into the new frame with pyramidal Lucas-Kanade optical flow
+ *	   (calcOpticalFlowPyrLK). This only looks at small windows around the four points.
+ *	2. The moved quad is verified with edge support: we sample points along each of the four sides and check that
+ *	   the image gradient across the side is strong there. A real document border has a strong gradient along its
+ *	   whole length, a quad that drifted off the paper doesn't.
+ * If any corner is lost, the quad folds over or one of the sides has too little edge support, track() returns false
+ * and the caller runs the full detection again and calls reset() with the new quad.
+ *
+ * Corners are kept in the order returned by reorder(): top-left, top-right, bottom-left, bottom-right.
+ */
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+class QuadTracker
+{
+public:
+	// Fraction of samples along every side that must lie on an edge for the tracked quad to be accepted.
+	double minSideSupport{ 0.6 };
+	// Smallest gradient (in gray levels per pixel) across a side that counts as an edge.
+	int edgeThreshold{ 12 };
+	// The tracked quad may not shrink or grow by more than this factor from one frame to the next.
+	double maxAreaChange{ 1.3 };
+
+	bool hasQuad() const { return !corners_.empty(); }
+
+	// Starts tracking a quad found by the full detection in this frame.
+	void reset(const cv::Mat& gray, const std::vector<cv::Point>& quad)
+	{
+		gray.copyTo(prevGray_);
+		corners_.assign(quad.begin(), quad.end());
+	}
+
+	void lose() { corners_.clear(); }
+
+	// Moves the quad from the previous frame into this one. On success `quad` holds the new corners.
+	bool track(const cv::Mat& gray, std::vector<cv::Point>& quad)
+	{
+		if (!hasQuad() || prevGray_.size() != gray.size())
+			return false;
+
+		cv::calcOpticalFlowPyrLK(prevGray_, gray, corners_, nextCorners_, status_, error_, cv::Size(21, 21), 3);
+		if (std::find(status_.begin(), status_.end(), 0) != status_.end())
+			return false;
+
+		if (!plausible(nextCorners_) || !supported(gray, nextCorners_))
+			return false;
+
+		// Keep the current frame for the next call. The sizes match, so copyTo() reuses the old buffer.
+		gray.copyTo(prevGray_);
+		std::swap(corners_, nextCorners_);
+		quad.resize(4);
+		for (int i{ 0 }; i < 4; ++i)
+			quad[i] = cv::Point(cvRound(corners_[i].x), cvRound(corners_[i].y));
+		return true;
+	}
+
+private:
+	// The polygon order of reorder()'s corners: top-left, top-right, bottom-right, bottom-left.
+	static constexpr int polygon[4]{ 0, 1, 3, 2 };
+
+	bool plausible(const std::vector<cv::Point2f>& corners) const
+	{
+		std::vector<cv::Point2f> poly{ corners[polygon[0]], corners[polygon[1]], corners[polygon[2]], corners[polygon[3]] };
+		std::vector<cv::Point2f> prevPoly{ corners_[polygon[0]], corners_[polygon[1]], corners_[polygon[2]], corners_[polygon[3]] };
+		if (!cv::isContourConvex(poly))
+			return false;
+
+		double area{ cv::contourArea(poly) };
+		double prevArea{ cv::contourArea(prevPoly) };
+		return area > 1000 && area < prevArea * maxAreaChange && area * maxAreaChange > prevArea;
+	}
+
+	bool supported(const cv::Mat& gray, const std::vector<cv::Point2f>& corners) const
+	{
+		for (int side{ 0 }; side < 4; ++side)
+		{
+			if (sideSupport(gray, corners[polygon[side]], corners[polygon[(side + 1) % 4]]) < minSideSupport)
+				return false;
+		}
+		return true;
+	}
+
+	// Fraction of sample points between a and b where the gradient across the line is strong. Each sample also
+	// looks one and two pixels to either side of the line, so a quad that is slightly off still counts.
+	double sideSupport(const cv::Mat& gray, cv::Point2f a, cv::Point2f b) const
+	{
+		const int samples{ 24 };
+		cv::Point2f dir{ b - a };
+		float length{ std::sqrt(dir.x * dir.x + dir.y * dir.y) };
+		if (length < 1.0f)
+			return 0.0;
+		cv::Point2f normal{ -dir.y / length, dir.x / length };
+
+		int hits{ 0 };
+		for (int s{ 1 }; s <= samples; ++s)
+		{
+			// Skip the ends, the corners themselves have gradients in every direction.
+			cv::Point2f p{ a + dir * (static_cast<float>(s) / (samples + 1)) };
+			for (int offset{ -2 }; offset <= 2; ++offset)
+			{
+				cv::Point2f q{ p + normal * static_cast<float>(offset) };
+				int x{ cvRound(q.x) }, y{ cvRound(q.y) };
+				if (x < 1 || y < 1 || x >= gray.cols - 1 || y >= gray.rows - 1)
+					continue;
+
+				int gx{ gray.at<uchar>(y, x + 1) - gray.at<uchar>(y, x - 1) };
+				int gy{ gray.at<uchar>(y + 1, x) - gray.at<uchar>(y - 1, x) };
+				if (std::abs(gx * normal.x + gy * normal.y) >= 2 * edgeThreshold)
+				{
+					++hits;
+					break;
+				}
+			}
+		}
+		return static_cast<double>(hits) / samples;
+	}
+
+	cv::Mat prevGray_;
+	std::vector<cv::Point2f> corners_, nextCorners_;
+	std::vector<uchar> status_;
+	std::vector<float> error_;
+};
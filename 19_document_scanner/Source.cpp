@@ -1,50 +1,188 @@
+/*
+ * Document scanner
+ * Finds the biggest four-sided contour in a photo of a document and warps it to a flat, top-down view.
+ *
+ * Usage:
+ *	Source [image] [--scale S]                        scan one image (default: ../img/doc.PNG) and display it
+ *	Source --batch <dir|list.txt> <outDir> [options]   scan every image in a directory or a list file
+ *	Source --video [file|camera] [--no-track]          scan a video file or camera stream (default: camera 0)
+ *
+ * Batch options:
+ *	--threads N     number of scanner threads (default: number of cores)
+ *	--io-threads N  number of decode threads and of encode threads (default: 2)
+ *	--inflight N    maximum number of images inside the pipeline at once (default: 2 * threads)
+ *	--scale S       find the document on a copy shrunk by S (default: 1, full resolution)
+ *	--warp-cache MB reuse remap tables for quads that repeat, up to MB megabytes (default: 0, off)
+ *
+ * Pyramid mode
+ * The document only needs to be found roughly, but preProcessing and getContours cost grows with the number of
+ * pixels, and for a 12 MP phone photo they are by far the most expensive part. With a scale below 1 we shrink the
+ * image first, find the quad on the small copy and scale its corners back up. One pixel of the small image covers
+ * 1/scale pixels of the original, so each corner is then refined with cornerSubPix in a small window of the
+ * full-resolution image. getWarp always runs on the original. A single-image run times both modes (default
+ * scale 0.25) so we can see the speedup.
+ *
+ * Batch mode
+ * A single image keeps only one core busy, so batch mode runs the work as a bounded pipeline:
+ *	decode -> preProcessing -> getContours -> reorder -> getWarp -> encode
+ * Decoding and encoding run on their own threads and the four scanner steps run on a pool of scanner threads. The
+ * stages are connected with bounded queues and the reader only starts a new image when one of the in-flight slots
+ * is free, so memory use stays flat no matter how many files there are. At the end we print how many images each
+ * stage handled, how long it was busy and how many images per second a single thread of that stage can do.
+ *
+ * Video mode
+ * Works like 02b_reading_from_webcam, but every frame is scanned and the warped document is shown next to the
+ * stream. Running the full detection on every frame wastes most of the frame budget, so once a document is found
+ * the QuadTracker follows its corners into the next frames (see QuadTracker.h) and the full detection only runs
+ * again when tracking fails. --no-track turns the tracker off for comparison. At the end we print which fraction of
+ * the frames was served by the tracker and the average time per frame of both paths.
+ *
+ * Warp cache
+ * On a fixed camera the quad barely moves, so getWarp can reuse the remap tables of an earlier warp instead of
+ * recomputing the mapping (see common/WarpCache.h). Video mode always uses one, batch mode with --warp-cache.
+ */
 #include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../common/WarpCache.h"
+#include "Pipeline.h"
+#include "QuadTracker.h"
 
-cv::Mat origImg, grayImg, blurImg, cannyImg, threImg, dilImg, warpImg, cropImg;
-std::vector<cv::Point> initPoints, finalPoints;
 float w = 420, h = 600;
 
-cv::Mat preProcessing(cv::Mat img)
+// Scratch memory for one scanner. Every step writes its intermediate image into a buffer owned by the context
+// instead of a fresh cv::Mat, and the buffers are reused from one call to the next. The backing storage only grows:
+// smaller images get a header over the front of it, so a stream of same-sized (or smaller) images never reallocates
+// these buffers after the first one. The headers are continuous images of exactly the requested size, not ROIs of
+// the bigger storage, so filters that read past the image border (GaussianBlur, Canny, dilate) see the border mode
+// and never the stale pixels of an earlier, larger image. Only the image buffers are reused: findContours() and the
+// contour vectors still allocate on every call. Each thread that scans needs its own context.
+class ScannerContext
 {
-	cv::cvtColor(img, grayImg, cv::COLOR_BGR2GRAY);
-	cv::GaussianBlur(grayImg, blurImg, cv::Size(3, 3), 3, 0);
-	cv::Canny(blurImg, cannyImg, 25, 75);
-	cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3));
-	cv::dilate(cannyImg, dilImg, kernel);
-	return dilImg;
-}
+public:
+	ScannerContext() : kernel{ cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3)) } {}
+	ScannerContext(const ScannerContext&) = delete;
+	ScannerContext& operator=(const ScannerContext&) = delete;
 
-std::vector<cv::Point> getContours(cv::Mat image) {
+	// Points grayImg, blurImg, cannyImg and dilImg at buffers big enough for an image of this size.
+	void prepare(cv::Size size)
+	{
+		useStorage(grayStore_, grayImg, size);
+		useStorage(blurStore_, blurImg, size);
+		useStorage(cannyStore_, cannyImg, size);
+		useStorage(dilStore_, dilImg, size);
+	}
 
+	// Points warpImg at a buffer for the warped document.
+	void prepareWarp(cv::Size size, int type)
+	{
+		useStorage(warpStore_, warpImg, size, type);
+	}
+
+	// Points smallImg at a buffer for the shrunk copy used by the pyramid mode.
+	void prepareSmall(cv::Size size, int type)
+	{
+		useStorage(smallStore_, smallImg, size, type);
+	}
+
+	// Points cornerImg at a buffer for the window around one corner during refinement.
+	void prepareCorner(cv::Size size)
+	{
+		useStorage(cornerStore_, cornerImg, size);
+	}
+
+	// Call after an OpenCV function wrote into one of the views. If the function had to reallocate its output the
+	// view no longer points into our storage, which we count as an allocation too.
+	void check(const cv::Mat& view)
+	{
+		for (const cv::Mat* store : { &grayStore_, &blurStore_, &cannyStore_, &dilStore_, &warpStore_, &smallStore_,
+			&cornerStore_ })
+		{
+			if (!store->empty() && view.data >= store->data && view.data < store->data + store->step[0] * store->rows)
+				return;
+		}
+		++allocations_;
+	}
+
+	// Number of times a scratch image buffer had to be (re)allocated. It goes up on the first image and when a
+	// bigger image arrives, and stays constant afterwards. Allocations inside findContours() aren't counted.
+	std::size_t allocations() const { return allocations_; }
+
+	cv::Mat grayImg, blurImg, cannyImg, dilImg, warpImg, smallImg, cornerImg;
+	cv::Mat kernel;
 	std::vector<std::vector<cv::Point>> contourPoints;
 	std::vector<cv::Vec4i> hierarchyVec;
+	std::vector<cv::Point> conPoly;
+	std::vector<cv::Point> biggestPoint;
+	std::vector<cv::Point2f> cornerPoint;
+	// Optional, shared between contexts. When set, getWarp reuses remap tables from it.
+	WarpCache* warpCache{ nullptr };
 
-	cv::findContours(image, contourPoints, hierarchyVec, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
-	std::vector<std::vector<cv::Point>> conPoly(contourPoints.size());
-	std::vector<cv::Rect> boundRect(contourPoints.size());
+private:
+	// The store is a row of bytes; the view is a header of the given size and type over its front.
+	void useStorage(cv::Mat& store, cv::Mat& view, cv::Size size, int type = CV_8UC1)
+	{
+		int bytes{ size.width * size.height * CV_ELEM_SIZE(type) };
+		if (store.cols < bytes)
+		{
+			store.create(1, bytes, CV_8UC1);
+			++allocations_;
+		}
+		view = cv::Mat(size, type, store.data);
+	}
 
-	std::vector<cv::Point> biggestPoint;
+	cv::Mat grayStore_, blurStore_, cannyStore_, dilStore_, warpStore_, smallStore_, cornerStore_;
+	std::size_t allocations_{ 0 };
+};
+
+cv::Mat preProcessing(ScannerContext& ctx, const cv::Mat& img)
+{
+	ctx.prepare(img.size());
+	cv::cvtColor(img, ctx.grayImg, cv::COLOR_BGR2GRAY);
+	ctx.check(ctx.grayImg);
+	cv::GaussianBlur(ctx.grayImg, ctx.blurImg, cv::Size(3, 3), 3, 0);
+	ctx.check(ctx.blurImg);
+	cv::Canny(ctx.blurImg, ctx.cannyImg, 25, 75);
+	ctx.check(ctx.cannyImg);
+	cv::dilate(ctx.cannyImg, ctx.dilImg, ctx.kernel);
+	ctx.check(ctx.dilImg);
+	return ctx.dilImg;
+}
+
+const std::vector<cv::Point>& getContours(ScannerContext& ctx, const cv::Mat& image, double minArea = 1000) {
+
+	cv::findContours(image, ctx.contourPoints, ctx.hierarchyVec, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+
+	ctx.biggestPoint.clear();
 	int maxArea = 0;
 
-	for (int i = 0; i < contourPoints.size(); i++)
+	for (int i = 0; i < ctx.contourPoints.size(); i++)
 	{
-		int contArea = cv::contourArea(contourPoints[i]);
-		std::string objectType;
+		int contArea = cv::contourArea(ctx.contourPoints[i]);
 
-		if (contArea > 1000)
+		if (contArea > minArea)
 		{
-			float perimeter = cv::arcLength(contourPoints[i], true);
-			cv::approxPolyDP(contourPoints[i], conPoly[i], 0.02 * perimeter, true);
+			float perimeter = cv::arcLength(ctx.contourPoints[i], true);
+			cv::approxPolyDP(ctx.contourPoints[i], ctx.conPoly, 0.02 * perimeter, true);
 
-			if (contArea > maxArea && conPoly[i].size() == 4) {
+			if (contArea > maxArea && ctx.conPoly.size() == 4) {
 
-				biggestPoint = { conPoly[i][0],conPoly[i][1] ,conPoly[i][2] ,conPoly[i][3] };
+				ctx.biggestPoint.assign(ctx.conPoly.begin(), ctx.conPoly.end());
 				maxArea = contArea;
 			}
 		}
 	}
-	return biggestPoint;
+	return ctx.biggestPoint;
 }
 
 std::vector<cv::Point> reorder(std::vector<cv::Point> points)
@@ -65,25 +203,500 @@ std::vector<cv::Point> reorder(std::vector<cv::Point> points)
 	return finPoints;
 }
 
-cv::Mat getWarp(cv::Mat img, std::vector<cv::Point> points, float w, float h)
+cv::Mat getWarp(ScannerContext& ctx, const cv::Mat& img, const std::vector<cv::Point>& points, float w, float h)
 {
 	cv::Point2f init[4] = { points[0],points[1],points[2],points[3] };
-	cv::Point2f final[4] = { {0.0f,0.0f},{w,0.0f},{0.0f,h},{w,h} };
-	cv::Mat finalMatrix = cv::getPerspectiveTransform(init, final);
-	cv::warpPerspective(img, warpImg, finalMatrix, cv::Point(w, h));
-	return warpImg;
+	ctx.prepareWarp(cv::Size(static_cast<int>(w), static_cast<int>(h)), img.type());
+	if (ctx.warpCache)
+		ctx.warpCache->warp(img, init, ctx.warpImg.size(), ctx.warpImg);
+	else
+	{
+		cv::Point2f final[4] = { {0.0f,0.0f},{w,0.0f},{0.0f,h},{w,h} };
+		cv::Mat finalMatrix = cv::getPerspectiveTransform(init, final);
+		cv::warpPerspective(img, ctx.warpImg, finalMatrix, ctx.warpImg.size());
+	}
+	ctx.check(ctx.warpImg);
+	return ctx.warpImg;
+}
+
+// Shrinks the image into the context for the coarse search of the pyramid mode.
+cv::Mat downscale(ScannerContext& ctx, const cv::Mat& img, double scale)
+{
+	cv::Size size{ std::max(1, cvRound(img.cols * scale)), std::max(1, cvRound(img.rows * scale)) };
+	ctx.prepareSmall(size, img.type());
+	cv::resize(img, ctx.smallImg, size, 0, 0, cv::INTER_AREA);
+	ctx.check(ctx.smallImg);
+	return ctx.smallImg;
+}
+
+// Scales corners found on the shrunk copy back up to the original image and snaps each of them to the real corner
+// with cornerSubPix in a small full-resolution window around it. A corner too close to the image border for the
+// window, or one that cornerSubPix moves implausibly far, keeps its scaled-up position.
+std::vector<cv::Point> refineCorners(ScannerContext& ctx, const cv::Mat& img, const std::vector<cv::Point>& points,
+	double scale)
+{
+	// A coarse corner can be off by about one pixel of the small image, which is 1/scale pixels of the original.
+	int radius{ std::max(3, cvCeil(2.0 / scale)) };
+	cv::Rect bounds{ 0, 0, img.cols, img.rows };
+	std::vector<cv::Point> refined(points.size());
+
+	for (std::size_t i{ 0 }; i < points.size(); ++i)
+	{
+		cv::Point2f coarse{ static_cast<float>(points[i].x / scale), static_cast<float>(points[i].y / scale) };
+		refined[i] = cv::Point(cvRound(coarse.x), cvRound(coarse.y));
+
+		cv::Rect window{ refined[i].x - 2 * radius, refined[i].y - 2 * radius, 4 * radius + 1, 4 * radius + 1 };
+		if ((window & bounds) != window)
+			continue;
+
+		ctx.prepareCorner(window.size());
+		cv::cvtColor(img(window), ctx.cornerImg, cv::COLOR_BGR2GRAY);
+		ctx.check(ctx.cornerImg);
+
+		ctx.cornerPoint.assign(1, coarse - cv::Point2f(window.tl()));
+		cv::cornerSubPix(ctx.cornerImg, ctx.cornerPoint, cv::Size(radius, radius), cv::Size(-1, -1),
+			cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 20, 0.03));
+
+		cv::Point2f fine{ ctx.cornerPoint[0] + cv::Point2f(window.tl()) };
+		cv::Point2f shift{ fine - coarse };
+		if (shift.x * shift.x + shift.y * shift.y <= 2.0f * radius * radius)
+			refined[i] = cv::Point(cvRound(fine.x), cvRound(fine.y));
+	}
+	return refined;
+}
+
+// Finds the four corners of the document, in the order of reorder(), or returns an empty vector. With a scale below
+// 1 the search runs on a shrunk copy and the corners are refined at full resolution.
+std::vector<cv::Point> findDocument(ScannerContext& ctx, const cv::Mat& img, double scale = 1.0)
+{
+	if (scale >= 1.0)
+	{
+		const std::vector<cv::Point>& initPoints{ getContours(ctx, preProcessing(ctx, img)) };
+		return initPoints.size() == 4 ? reorder(initPoints) : std::vector<cv::Point>{};
+	}
+
+	// The area limit of getContours is in pixels, so it shrinks with the image.
+	const std::vector<cv::Point>& initPoints{ getContours(ctx, preProcessing(ctx, downscale(ctx, img, scale)),
+		1000 * scale * scale) };
+	if (initPoints.size() != 4)
+		return {};
+	return refineCorners(ctx, img, reorder(initPoints), scale);
+}
+
+// One image travelling through the batch pipeline.
+struct ScanJob
+{
+	std::filesystem::path input;
+	std::filesystem::path output;
+	cv::Mat img;
+	cv::Mat warpImg;
+};
+
+// Collects the images to scan. A directory is searched (not recursively) for image files, anything else is read as
+// a text file with one path per line.
+std::vector<std::filesystem::path> listInputs(const std::filesystem::path& source)
+{
+	std::vector<std::filesystem::path> paths;
+
+	if (std::filesystem::is_directory(source))
+	{
+		const std::vector<std::string> extensions{ ".jpg", ".jpeg", ".png", ".bmp", ".tif", ".tiff" };
+		for (const auto& entry : std::filesystem::directory_iterator(source))
+		{
+			std::string ext{ entry.path().extension().string() };
+			std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+			if (entry.is_regular_file() && std::find(extensions.begin(), extensions.end(), ext) != extensions.end())
+				paths.push_back(entry.path());
+		}
+		std::sort(paths.begin(), paths.end());
+	}
+	else
+	{
+		std::ifstream list{ source };
+		std::string line;
+		while (std::getline(list, line))
+		{
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+			if (!line.empty())
+				paths.emplace_back(line);
+		}
+	}
+
+	return paths;
+}
+
+// The name of the scan of `input` in the output directory: its stem plus "_scan.jpg". A list file can name images
+// with the same stem in different directories, so a name that's already taken gets a number appended.
+std::string outputName(const std::filesystem::path& input, std::set<std::string>& taken)
+{
+	std::string stem{ input.stem().string() };
+	std::string name{ stem + "_scan.jpg" };
+	for (int n{ 2 }; !taken.insert(name).second; ++n)
+		name = stem + "_" + std::to_string(n) + "_scan.jpg";
+	return name;
+}
+
+int runBatch(int argc, char** argv)
+{
+	if (argc < 4)
+	{
+		std::cerr << "Usage: " << argv[0]
+			<< " --batch <dir|list.txt> <outDir> [--threads N] [--io-threads N] [--inflight N] [--scale S]"
+			<< " [--warp-cache MB]\n";
+		return 1;
+	}
+
+	std::filesystem::path source{ argv[2] };
+	std::filesystem::path outDir{ argv[3] };
+	int threads{ std::max(1, static_cast<int>(std::thread::hardware_concurrency())) };
+	int ioThreads{ 2 };
+	int inflight{ 0 };
+	double scale{ 1.0 };
+	int warpCacheMb{ 0 };
+
+	for (int i{ 4 }; i < argc; i += 2)
+	{
+		std::string option{ argv[i] };
+		if (i + 1 == argc)
+		{
+			std::cerr << "Missing value for " << option << '\n';
+			return 1;
+		}
+		int value{ std::max(1, std::atoi(argv[i + 1])) };
+		if (option == "--scale")
+			scale = std::clamp(std::atof(argv[i + 1]), 0.05, 1.0);
+		else if (option == "--warp-cache")
+			warpCacheMb = std::max(0, std::atoi(argv[i + 1]));
+		else if (option == "--threads")
+			threads = value;
+		else if (option == "--io-threads")
+			ioThreads = value;
+		else if (option == "--inflight")
+			inflight = value;
+		else
+		{
+			std::cerr << "Unknown option " << option << '\n';
+			return 1;
+		}
+	}
+	if (inflight == 0)
+		inflight = 2 * threads;
+
+	std::vector<std::filesystem::path> inputs{ listInputs(source) };
+	if (inputs.empty())
+	{
+		std::cerr << "No images found in " << source << '\n';
+		return 1;
+	}
+	std::filesystem::create_directories(outDir);
+
+	// Our pipeline already keeps every core busy, so OpenCV's own parallel loops would only oversubscribe the CPU.
+	cv::setNumThreads(1);
+
+	StageStats decodeStats{ "decode" }, preStats{ "preProcessing" }, contourStats{ "getContours" };
+	StageStats reorderStats{ "reorder" }, refineStats{ "refineCorners" }, warpStats{ "getWarp" };
+	StageStats encodeStats{ "encode" };
+	std::atomic<int> scanned{ 0 }, notFound{ 0 }, unreadable{ 0 };
+
+	BoundedQueue<ScanJob> decodeQueue{ static_cast<std::size_t>(inflight) };
+	BoundedQueue<ScanJob> scanQueue{ static_cast<std::size_t>(inflight) };
+	BoundedQueue<ScanJob> encodeQueue{ static_cast<std::size_t>(inflight) };
+	Semaphore slots{ inflight };
+	std::vector<std::thread> workers;
+
+	// One scratch context per scanner thread, and one output buffer per in-flight slot. The warped document has to
+	// outlive the scanner step (it waits in the encode queue), so it's copied out of the context into a buffer that
+	// the encode stage gives back once the file is written.
+	std::vector<ScannerContext> contexts(threads);
+	WarpCache warpCache{ static_cast<std::size_t>(warpCacheMb) << 20 };
+	if (warpCacheMb > 0)
+	{
+		for (auto& ctx : contexts)
+			ctx.warpCache = &warpCache;
+	}
+	BoundedQueue<cv::Mat> freeWarps{ static_cast<std::size_t>(inflight) };
+	for (int i{ 0 }; i < inflight; ++i)
+		freeWarps.push(cv::Mat(static_cast<int>(h), static_cast<int>(w), CV_8UC3));
+
+	auto start{ std::chrono::steady_clock::now() };
+
+	startStage(workers, ioThreads, decodeQueue, &scanQueue, [&](ScanJob& job, int)
+		{
+			StageTimer timer{ decodeStats };
+			job.img = cv::imread(job.input.string());
+			if (job.img.empty())
+			{
+				++unreadable;
+				slots.release();
+				return false;
+			}
+			return true;
+		});
+
+	startStage(workers, threads, scanQueue, &encodeQueue, [&](ScanJob& job, int worker)
+		{
+			ScannerContext& ctx{ contexts[worker] };
+			cv::Mat threImg;
+			{
+				StageTimer timer{ preStats };
+				threImg = preProcessing(ctx, scale < 1.0 ? downscale(ctx, job.img, scale) : job.img);
+			}
+			{
+				StageTimer timer{ contourStats };
+				getContours(ctx, threImg, 1000 * scale * scale);
+			}
+			const std::vector<cv::Point>& initPoints{ ctx.biggestPoint };
+			if (initPoints.size() != 4)
+			{
+				++notFound;
+				slots.release();
+				return false;
+			}
+			std::vector<cv::Point> finalPoints;
+			{
+				StageTimer timer{ reorderStats };
+				finalPoints = reorder(initPoints);
+			}
+			if (scale < 1.0)
+			{
+				StageTimer timer{ refineStats };
+				finalPoints = refineCorners(ctx, job.img, finalPoints, scale);
+			}
+			{
+				StageTimer timer{ warpStats };
+				job.warpImg = *freeWarps.pop();
+				getWarp(ctx, job.img, finalPoints, w, h).copyTo(job.warpImg);
+			}
+			// The full-size image isn't needed any more, release it before the job waits in the encode queue.
+			job.img.release();
+			return true;
+		});
+
+	startStage(workers, ioThreads, encodeQueue, static_cast<BoundedQueue<ScanJob>*>(nullptr), [&](ScanJob& job, int)
+		{
+			{
+				StageTimer timer{ encodeStats };
+				if (cv::imwrite(job.output.string(), job.warpImg))
+					++scanned;
+				else
+					++unreadable;
+			}
+			freeWarps.push(std::move(job.warpImg));
+			slots.release();
+			return true;
+		});
+
+	// Feed the pipeline. A slot is taken before each image and given back when the image leaves the pipeline.
+	std::set<std::string> outputNames;
+	for (const auto& input : inputs)
+	{
+		slots.acquire();
+		ScanJob job;
+		job.input = input;
+		job.output = outDir / outputName(input, outputNames);
+		decodeQueue.push(std::move(job));
+	}
+	decodeQueue.close();
+
+	for (auto& t : workers)
+		t.join();
+
+	double seconds{ std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() };
+
+	std::cout << "Scanned " << scanned << " of " << inputs.size() << " images (" << notFound << " without a document, "
+		<< unreadable << " unreadable) in " << std::fixed << std::setprecision(2) << seconds << " s, "
+		<< inputs.size() / seconds << " img/s\n";
+	std::cout << "threads: " << threads << ", io-threads: " << ioThreads << ", inflight: " << inflight << ", scale: "
+		<< scale << '\n';
+
+	std::size_t allocations{ 0 };
+	for (const auto& ctx : contexts)
+		allocations += ctx.allocations();
+	std::cout << "scratch buffer allocations: " << allocations << " across " << contexts.size() << " contexts\n";
+	if (warpCacheMb > 0)
+		std::cout << "warp cache: " << warpCache.hits() << " hits, " << warpCache.misses() << " misses, "
+			<< warpCache.evictions() << " evictions, " << warpCache.bytes() / (1 << 20) << " MB in "
+			<< warpCache.entries() << " entries\n";
+	std::cout << '\n';
+	std::cout << std::left << std::setw(16) << "stage" << std::right << std::setw(10) << "images" << std::setw(12)
+		<< "busy ms" << std::setw(10) << "ms/img" << std::setw(16) << "img/s/thread" << '\n';
+	for (const StageStats* stats : { &decodeStats, &preStats, &contourStats, &reorderStats, &refineStats, &warpStats,
+		&encodeStats })
+	{
+		double perItem{ stats->msPerItem() };
+		std::cout << std::left << std::setw(16) << stats->name << std::right << std::setw(10) << stats->items
+			<< std::setw(12) << stats->busyMs() << std::setw(10) << perItem << std::setw(16)
+			<< (perItem > 0 ? 1000.0 / perItem : 0.0) << '\n';
+	}
+
+	return 0;
+}
+
+int runVideo(int argc, char** argv)
+{
+	std::string source{ "0" };
+	bool useTracker{ true };
+	for (int i{ 2 }; i < argc; ++i)
+	{
+		std::string arg{ argv[i] };
+		if (arg == "--no-track")
+			useTracker = false;
+		else
+			source = arg;
+	}
+
+	// A plain number is a camera index, anything else is a path to a video file.
+	cv::VideoCapture cap;
+	if (!source.empty() && std::all_of(source.begin(), source.end(), [](unsigned char c) { return std::isdigit(c); }))
+		cap.open(std::stoi(source));
+	else
+		cap.open(source);
+	if (!cap.isOpened())
+	{
+		std::cerr << "Cannot open " << source << '\n';
+		return 1;
+	}
+
+	ScannerContext ctx;
+	WarpCache warpCache;
+	ctx.warpCache = &warpCache;
+	QuadTracker tracker;
+	cv::Mat frame;
+	std::vector<cv::Point> quad;
+	int frames{ 0 }, trackedFrames{ 0 }, detectedFrames{ 0 };
+	double trackMs{ 0 }, detectMs{ 0 };
+
+	while (cap.read(frame) && !frame.empty())
+	{
+		++frames;
+		auto start{ std::chrono::steady_clock::now() };
+
+		// Fast path: follow the quad from the previous frame.
+		ctx.prepare(frame.size());
+		cv::cvtColor(frame, ctx.grayImg, cv::COLOR_BGR2GRAY);
+		bool found{ useTracker && tracker.track(ctx.grayImg, quad) };
+
+		if (found)
+		{
+			++trackedFrames;
+			trackMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+		else
+		{
+			// Slow path: find the document from scratch and start tracking it.
+			cv::Mat threImg = preProcessing(ctx, frame);
+			const std::vector<cv::Point>& initPoints{ getContours(ctx, threImg) };
+			found = initPoints.size() == 4;
+			if (found)
+			{
+				quad = reorder(initPoints);
+				tracker.reset(ctx.grayImg, quad);
+			}
+			else
+				tracker.lose();
+			++detectedFrames;
+			detectMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		if (found)
+		{
+			cv::imshow("Final Document", getWarp(ctx, frame, quad, w, h));
+			std::vector<cv::Point> outline{ quad[0], quad[1], quad[3], quad[2] };
+			cv::polylines(frame, outline, true, cv::Scalar(0, 255, 0), 2);
+		}
+
+		std::string status{ "tracked " + std::to_string(100 * trackedFrames / frames) + "% of frames" };
+		cv::putText(frame, status, cv::Point(10, 30), cv::FONT_HERSHEY_SIMPLEX, 0.8, cv::Scalar(0, 0, 255), 2);
+		cv::imshow("Frame", frame);
+
+		int key{ cv::waitKey(1) };
+		if (key == 'q')
+			break;
+	}
+
+	cap.release();
+	cv::destroyAllWindows();
+
+	if (frames == 0)
+		return 0;
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "Frames: " << frames << ", served by tracker: " << trackedFrames << " ("
+		<< 100.0 * trackedFrames / frames << "%), full detection: " << detectedFrames << '\n';
+	std::cout << "Average ms/frame - tracker: " << (trackedFrames > 0 ? trackMs / trackedFrames : 0.0)
+		<< ", full detection: " << (detectedFrames > 0 ? detectMs / detectedFrames : 0.0) << '\n';
+	std::cout << "Warp cache: " << warpCache.hits() << " hits, " << warpCache.misses() << " misses\n";
+
+	return 0;
 }
 
-int main()
+int main(int argc, char** argv)
 {
-	std::string path = "../img/doc.png";
+	if (argc > 1 && std::string{ argv[1] } == "--batch")
+		return runBatch(argc, argv);
+	if (argc > 1 && std::string{ argv[1] } == "--video")
+		return runVideo(argc, argv);
+
+	std::string path = "../img/doc.PNG";
+	double scale{ 0.25 };
+	for (int i{ 1 }; i < argc; ++i)
+	{
+		std::string arg{ argv[i] };
+		if (arg == "--scale" && i + 1 < argc)
+			scale = std::clamp(std::atof(argv[++i]), 0.05, 1.0);
+		else
+			path = arg;
+	}
+
+	ScannerContext ctx;
 	cv::Mat origImg = cv::imread(path);
-	cv::Mat threImg = preProcessing(origImg);
-	std::vector<cv::Point> initPoints = getContours(threImg);
-	std::vector<cv::Point> finalPoints = reorder(initPoints);
-	cv::Mat warpImg = getWarp(origImg, finalPoints, w, h);
+	if (origImg.empty())
+	{
+		std::cerr << "Cannot read " << path << '\n';
+		return 1;
+	}
+
+	// Time finding the document at full resolution and with the pyramid. The first call of each warms up the buffers
+	// of the context, so it isn't counted.
+	const int runs{ 10 };
+	std::vector<cv::Point> fullPoints, finalPoints;
+	double fullMs{ 0 }, pyramidMs{ 0 };
+	for (int run{ 0 }; run <= runs; ++run)
+	{
+		auto start{ std::chrono::steady_clock::now() };
+		fullPoints = findDocument(ctx, origImg);
+		auto middle{ std::chrono::steady_clock::now() };
+		finalPoints = findDocument(ctx, origImg, scale);
+		auto end{ std::chrono::steady_clock::now() };
+		if (run > 0)
+		{
+			fullMs += std::chrono::duration<double, std::milli>(middle - start).count();
+			pyramidMs += std::chrono::duration<double, std::milli>(end - middle).count();
+		}
+	}
+	fullMs /= runs;
+	pyramidMs /= runs;
+
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "Image " << origImg.cols << "x" << origImg.rows << '\n';
+	std::cout << "Full resolution:     " << fullMs << " ms\n";
+	std::cout << "Pyramid (scale " << scale << "): " << pyramidMs << " ms (" << fullMs / pyramidMs << "x faster)\n";
+	if (fullPoints.size() == 4 && finalPoints.size() == 4)
+	{
+		double maxShift{ 0 };
+		for (int i{ 0 }; i < 4; ++i)
+			maxShift = std::max(maxShift, cv::norm(fullPoints[i] - finalPoints[i]));
+		std::cout << "Largest corner difference between the modes: " << maxShift << " px\n";
+	}
+	if (finalPoints.size() != 4)
+	{
+		std::cerr << "No document found in " << path << '\n';
+		return 1;
+	}
+
+	cv::Mat warpImg = getWarp(ctx, origImg, finalPoints, w, h);
 	cv::imshow("Image", origImg);
 	cv::imshow("Final Document", warpImg);
 	cv::waitKey(0);
 	return 0;
-}
\ No newline at end of file
+}
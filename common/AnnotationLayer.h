@@ -0,0 +1,203 @@
+/*
+ * A layer of annotations (lines, rectangles, circles, polygons, text) drawn onto a frame in one pass.
+ *
+ * Calling cv::circle(), cv::rectangle() or cv::putText() for every annotation walks the frame once per shape, in the
+ * order they come, on one core. With hundreds of annotations per frame, each one touches memory that the previous
+ * one has already pushed out of the cache. AnnotationLayer collects the shapes first and draws them later:
+ *	1. Every shape added is given its bounding box (including the line thickness). Shapes completely outside the
+ *	   viewport are dropped right away (culled()).
+ *	2. The viewport is divided into square tiles, and each shape is listed in every tile its bounding box touches.
+ *	   Within a tile the shapes stay in the order they were added, so later shapes are drawn over earlier ones.
+ *	3. render() draws the tiles in parallel with cv::parallel_for_(). A tile is small enough to stay in the L2 cache
+ *	   while all of its shapes are drawn into it, and tiles without shapes aren't touched at all.
+ *	4. With opacity below 1 the shapes of a tile are drawn onto a copy of the tile, which is then blended onto the
+ *	   frame with addWeighted(), so overlapping shapes don't get darker where they overlap.
+ * A shape is drawn into a tile with the OpenCV drawing functions, moved by the tile's position, and the functions
+ * clip it to the tile. The pixels are those of drawing onto the whole frame, except that a line crossing a tile
+ * border can move by a pixel there, because the line is clipped before it's rasterized.
+ *
+ * The layer can be kept and rendered again (e.g. a static overlay over every frame of a video), or clear()ed and
+ * filled anew for each frame; clear() keeps the memory.
+ */
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+class AnnotationLayer
+{
+public:
+	explicit AnnotationLayer(cv::Size viewport, int tileSize = 128)
+		: viewport_{ viewport }, tileSize_{ std::max(16, tileSize) },
+		tilesX_{ (viewport.width + tileSize_ - 1) / tileSize_ }, tilesY_{ (viewport.height + tileSize_ - 1) / tileSize_ },
+		tiles_(static_cast<std::size_t>(tilesX_) * tilesY_) {}
+
+	void line(cv::Point a, cv::Point b, const cv::Scalar& color, int thickness = 1, int lineType = cv::LINE_8)
+	{
+		Shape shape{ Kind::line, { a, b }, color, thickness, lineType };
+		add(shape, cv::Rect(a, b));
+	}
+
+	void rectangle(cv::Rect rect, const cv::Scalar& color, int thickness = 1, int lineType = cv::LINE_8)
+	{
+		Shape shape{ Kind::rectangle, { rect.tl(), rect.br() - cv::Point(1, 1) }, color, thickness, lineType };
+		add(shape, rect);
+	}
+
+	void circle(cv::Point center, int radius, const cv::Scalar& color, int thickness = 1, int lineType = cv::LINE_8)
+	{
+		Shape shape{ Kind::circle, { center }, color, thickness, lineType };
+		shape.radius = radius;
+		add(shape, cv::Rect(center.x - radius, center.y - radius, 2 * radius + 1, 2 * radius + 1));
+	}
+
+	// A polygon outline, or a filled polygon with thickness cv::FILLED.
+	void polygon(const std::vector<cv::Point>& points, bool closed, const cv::Scalar& color, int thickness = 1,
+		int lineType = cv::LINE_8)
+	{
+		if (points.empty())
+			return;
+		Shape shape{ Kind::polygon, points, color, thickness, lineType };
+		shape.closed = closed;
+		add(shape, cv::boundingRect(points));
+	}
+
+	void text(const std::string& text, cv::Point origin, int fontFace, double fontScale, const cv::Scalar& color,
+		int thickness = 1, int lineType = cv::LINE_8)
+	{
+		Shape shape{ Kind::text, { origin }, color, thickness, lineType };
+		shape.text = text;
+		shape.fontFace = fontFace;
+		shape.fontScale = fontScale;
+		int baseline{ 0 };
+		cv::Size size{ cv::getTextSize(text, fontFace, fontScale, thickness, &baseline) };
+		add(shape, cv::Rect(origin.x, origin.y - size.height, size.width, size.height + baseline));
+	}
+
+	// Removes all shapes, keeps the memory for the next frame.
+	void clear()
+	{
+		shapes_.clear();
+		for (auto& tile : tiles_)
+			tile.clear();
+		culled_ = 0;
+	}
+
+	std::size_t size() const { return shapes_.size(); }
+	// Shapes dropped because they were outside the viewport.
+	std::size_t culled() const { return culled_; }
+
+	// Draws all shapes onto frame (the size of the viewport), blended with `opacity`.
+	void render(cv::Mat& frame, double opacity = 1.0) const
+	{
+		CV_Assert(frame.size() == viewport_);
+		cv::parallel_for_(cv::Range(0, static_cast<int>(tiles_.size())), [&](const cv::Range& range)
+			{
+				cv::Mat copy;
+				for (int t{ range.start }; t < range.end; ++t)
+				{
+					if (tiles_[t].empty())
+						continue;
+					cv::Rect area{ tileRect(t) };
+					cv::Mat tile{ frame(area) };
+					if (opacity >= 1.0)
+					{
+						drawTile(tile, t, area.tl());
+						continue;
+					}
+					tile.copyTo(copy);
+					drawTile(copy, t, area.tl());
+					cv::addWeighted(copy, opacity, tile, 1.0 - opacity, 0.0, tile);
+				}
+			});
+	}
+
+private:
+	enum class Kind { line, rectangle, circle, polygon, text };
+
+	struct Shape
+	{
+		Kind kind;
+		std::vector<cv::Point> points;
+		cv::Scalar color;
+		int thickness;
+		int lineType;
+		int radius{ 0 };
+		bool closed{ false };
+		std::string text;
+		int fontFace{ 0 };
+		double fontScale{ 1.0 };
+	};
+
+	// Culls the shape, or stores it and lists it in every tile its box (grown by the line thickness) touches.
+	void add(Shape& shape, cv::Rect box)
+	{
+		int grow{ shape.thickness > 0 ? shape.thickness / 2 + 2 : 1 };
+		box = cv::Rect(box.x - grow, box.y - grow, box.width + 2 * grow, box.height + 2 * grow) &
+			cv::Rect(0, 0, viewport_.width, viewport_.height);
+		if (box.empty())
+		{
+			++culled_;
+			return;
+		}
+
+		int index{ static_cast<int>(shapes_.size()) };
+		shapes_.push_back(std::move(shape));
+		for (int ty{ box.y / tileSize_ }; ty <= (box.y + box.height - 1) / tileSize_; ++ty)
+		{
+			for (int tx{ box.x / tileSize_ }; tx <= (box.x + box.width - 1) / tileSize_; ++tx)
+				tiles_[static_cast<std::size_t>(ty) * tilesX_ + tx].push_back(index);
+		}
+	}
+
+	cv::Rect tileRect(int t) const
+	{
+		cv::Rect rect{ (t % tilesX_) * tileSize_, (t / tilesX_) * tileSize_, tileSize_, tileSize_ };
+		return rect & cv::Rect(0, 0, viewport_.width, viewport_.height);
+	}
+
+	// Draws the shapes of tile t into `tile`, whose top-left pixel is at `origin` in the frame.
+	void drawTile(cv::Mat& tile, int t, cv::Point origin) const
+	{
+		std::vector<cv::Point> moved;
+		for (int index : tiles_[t])
+		{
+			const Shape& s{ shapes_[index] };
+			moved.resize(s.points.size());
+			for (std::size_t i{ 0 }; i < s.points.size(); ++i)
+				moved[i] = s.points[i] - origin;
+
+			switch (s.kind)
+			{
+			case Kind::line:
+				cv::line(tile, moved[0], moved[1], s.color, s.thickness, s.lineType);
+				break;
+			case Kind::rectangle:
+				cv::rectangle(tile, moved[0], moved[1], s.color, s.thickness, s.lineType);
+				break;
+			case Kind::circle:
+				cv::circle(tile, moved[0], s.radius, s.color, s.thickness, s.lineType);
+				break;
+			case Kind::polygon:
+				if (s.thickness < 0)
+					cv::fillPoly(tile, std::vector<std::vector<cv::Point>>{ moved }, s.color, s.lineType);
+				else
+					cv::polylines(tile, moved, s.closed, s.color, s.thickness, s.lineType);
+				break;
+			case Kind::text:
+				cv::putText(tile, s.text, moved[0], s.fontFace, s.fontScale, s.color, s.thickness, s.lineType);
+				break;
+			}
+		}
+	}
+
+	cv::Size viewport_;
+	int tileSize_;
+	int tilesX_, tilesY_;
+	std::vector<Shape> shapes_;
+	std::vector<std::vector<int>> tiles_;
+	std::size_t culled_{ 0 };
+};
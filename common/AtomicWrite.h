@@ -0,0 +1,52 @@
+/*
+ * Writing a file so that readers never see it half written.
+ *
+ * Files that other processes map into memory (the lookup tables of 04_color_spaces, the compiled cascade of
+ * 17_face_detection) must not be rewritten in place: a reader that maps the file while it's being written sees a
+ * truncated or half-filled file. writeFileAtomically() writes everything to a temporary file next to the target, under
+ * a name no other writer uses at the same moment, and renames it over the target only when it's complete. A rename
+ * within one directory is atomic, so a reader finds either the old file, no file, or the new complete one.
+ *
+ * If two processes write the same file at once, the later rename wins, and both files were complete. On Windows the
+ * rename fails while another process has the target mapped; the target is then left as it is, since it was written
+ * the same way and is complete too.
+ */
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+
+// Calls write(out) with a stream to a temporary file and renames the file to `path` if everything was written. Returns
+// false if the file couldn't be written and no complete file is at `path`.
+template <typename Write>
+bool writeFileAtomically(const std::filesystem::path& path, Write write)
+{
+	std::ostringstream name;
+	name << path.filename().string() << '.' << std::hash<std::thread::id>{}(std::this_thread::get_id()) << '.'
+		<< std::chrono::steady_clock::now().time_since_epoch().count() << ".tmp";
+	std::filesystem::path temporary{ path.parent_path() / name.str() };
+
+	std::error_code ec;
+	{
+		std::ofstream out{ temporary, std::ios::binary };
+		write(out);
+		out.close();
+		if (out.fail())
+		{
+			std::filesystem::remove(temporary, ec);
+			return false;
+		}
+	}
+
+	std::filesystem::rename(temporary, path, ec);
+	if (!ec)
+		return true;
+	std::filesystem::remove(temporary, ec);
+	return std::filesystem::exists(path, ec);
+}
@@ -0,0 +1,169 @@
+/*
+ * Gaussian blur whose cost doesn't depend on the kernel size.
+ *
+ * GaussianBlur() multiplies every pixel by every kernel weight, once along the rows and once along the columns, so a
+ * 151x151 kernel costs about 20 times more than a 7x7 one. A box filter (every weight the same) can be done with a
+ * running sum instead: moving the window one pixel adds the pixel that enters it and subtracts the one that leaves,
+ * two operations per pixel for any width. Three box filters one after the other give a curve very close to a
+ * Gaussian (central limit theorem), so boxBlur() approximates GaussianBlur() with 3 box passes along the rows and 3
+ * along the columns, 12 additions per pixel and channel whatever the kernel size.
+ *
+ * The box widths come from the Gaussian's sigma: they are odd, and chosen so the variance of the three boxes together
+ * is as close as possible to sigma^2 (W. Jarosz, "Fast image convolutions", and P. Kovesi, "Fast almost-Gaussian
+ * filtering"). As for GaussianBlur(), sigma = 0 means it's computed from the kernel size.
+ *
+ * The row passes run in parallel over rows, the three passes of a row one after the other while the row is in the
+ * cache. The column passes run in parallel over strips of columns: each strip walks down the image once per pass,
+ * keeping one running sum per column, so memory is read row by row. Borders are handled like BORDER_REFLECT_101,
+ * GaussianBlur()'s default. Only 8-bit images are supported, other depths go to GaussianBlur().
+ */
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace box_blur
+{
+	constexpr int passes{ 3 };
+
+	// Sigma of GaussianBlur() for a kernel size, with the same default for sigma = 0 (see getGaussianKernel()).
+	inline double sigmaFor(int ksize, double sigma)
+	{
+		return sigma > 0 ? sigma : 0.3 * ((ksize - 1) * 0.5 - 1) + 0.8;
+	}
+
+	// Widths of the 3 odd boxes whose variance together is closest to sigma^2.
+	inline std::array<int, passes> boxWidths(double sigma)
+	{
+		double ideal{ std::sqrt(12.0 * sigma * sigma / passes + 1.0) };
+		int lower{ static_cast<int>(std::floor(ideal)) };
+		if (lower % 2 == 0)
+			--lower;
+		lower = std::max(lower, 1);
+		int upper{ lower + 2 };
+		// How many boxes get the lower width.
+		double m{ (12.0 * sigma * sigma - passes * lower * lower - 4.0 * passes * lower - 3.0 * passes) /
+			(-4.0 * lower - 4.0) };
+		int lowerCount{ std::max(0, std::min(passes, static_cast<int>(std::round(m)))) };
+
+		std::array<int, passes> widths{};
+		for (int i{ 0 }; i < passes; ++i)
+			widths[i] = i < lowerCount ? lower : upper;
+		return widths;
+	}
+
+	// Averages a line of `length` pixels with `cn` interleaved channels with a box of width 2 * radius + 1. `in` and
+	// `out` must not overlap.
+	inline void boxLine(const uchar* in, uchar* out, int length, int cn, int radius)
+	{
+		const int width{ 2 * radius + 1 };
+		// Division by the width as a multiplication: sum * scale >> 24, rounded.
+		const std::uint64_t scale{ ((1ull << 24) + width / 2) / width };
+		auto at{ [&](int i, int c) { return in[cv::borderInterpolate(i, length, cv::BORDER_REFLECT_101) * cn + c]; } };
+
+		for (int c{ 0 }; c < cn; ++c)
+		{
+			int sum{ 0 };
+			for (int k{ -radius }; k <= radius; ++k)
+				sum += at(k, c);
+			out[c] = static_cast<uchar>((sum * scale + (1u << 23)) >> 24);
+			for (int x{ 1 }; x < length; ++x)
+			{
+				int enter{ x + radius }, leave{ x - radius - 1 };
+				// Only the pixels near the ends need the border lookup.
+				sum += enter < length ? in[enter * cn + c] : at(enter, c);
+				sum -= leave >= 0 ? in[leave * cn + c] : at(leave, c);
+				out[x * cn + c] = static_cast<uchar>((sum * scale + (1u << 23)) >> 24);
+			}
+		}
+	}
+
+	// Box filter of width 2 * radius + 1 down the columns of a strip of `width` bytes. `in` and `out` hold `rows` rows
+	// of the strip, inStep and outStep bytes apart.
+	inline void boxColumns(const uchar* in, std::size_t inStep, uchar* out, std::size_t outStep, int rows, int width,
+		int radius, std::vector<int>& sums)
+	{
+		const int boxWidth{ 2 * radius + 1 };
+		const std::uint64_t scale{ ((1ull << 24) + boxWidth / 2) / boxWidth };
+		auto row{ [&](int y) { return in + cv::borderInterpolate(y, rows, cv::BORDER_REFLECT_101) * inStep; } };
+
+		sums.assign(width, 0);
+		for (int k{ -radius }; k <= radius; ++k)
+		{
+			const uchar* r{ row(k) };
+			for (int x{ 0 }; x < width; ++x)
+				sums[x] += r[x];
+		}
+		for (int y{ 0 }; y < rows; ++y)
+		{
+			uchar* o{ out + y * outStep };
+			for (int x{ 0 }; x < width; ++x)
+				o[x] = static_cast<uchar>((sums[x] * scale + (1u << 23)) >> 24);
+			if (y + 1 == rows)
+				break;
+			const uchar* enter{ row(y + radius + 1) };
+			const uchar* leave{ row(y - radius) };
+			for (int x{ 0 }; x < width; ++x)
+				sums[x] += enter[x] - leave[x];
+		}
+	}
+
+	// How far from a pixel boxBlur() reads: the sum of the radii of the boxes.
+	inline int reach(int ksize, double sigma)
+	{
+		int total{ 0 };
+		for (int width : boxWidths(sigmaFor(ksize, sigma)))
+			total += width / 2;
+		return total;
+	}
+}
+
+// Approximates GaussianBlur(src, dst, cv::Size(ksize, ksize), sigma) with 3 box filters in each direction. The cost per
+// pixel is the same for every kernel size.
+inline void boxBlur(const cv::Mat& src, cv::Mat& dst, int ksize, double sigma = 0)
+{
+	if (src.depth() != CV_8U)
+	{
+		cv::GaussianBlur(src, dst, cv::Size(ksize, ksize), sigma);
+		return;
+	}
+	std::array<int, box_blur::passes> widths{ box_blur::boxWidths(box_blur::sigmaFor(ksize, sigma)) };
+	const int cn{ src.channels() };
+
+	// Rows: all passes of a row one after the other, between two row buffers.
+	cv::Mat horizontal(src.size(), src.type());
+	cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range)
+		{
+			std::vector<uchar> a(src.cols * cn), b(src.cols * cn);
+			for (int y{ range.start }; y < range.end; ++y)
+			{
+				box_blur::boxLine(src.ptr<uchar>(y), a.data(), src.cols, cn, widths[0] / 2);
+				box_blur::boxLine(a.data(), b.data(), src.cols, cn, widths[1] / 2);
+				box_blur::boxLine(b.data(), horizontal.ptr<uchar>(y), src.cols, cn, widths[2] / 2);
+			}
+		});
+
+	// Columns: strips of 256 bytes, all passes of a strip one after the other.
+	dst.create(src.size(), src.type());
+	const int bytes{ src.cols * cn };
+	const int stripWidth{ 256 };
+	const int strips{ (bytes + stripWidth - 1) / stripWidth };
+	cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range& range)
+		{
+			std::vector<uchar> a(static_cast<std::size_t>(src.rows) * stripWidth), b(a.size());
+			std::vector<int> sums;
+			for (int s{ range.start }; s < range.end; ++s)
+			{
+				int x{ s * stripWidth }, width{ std::min(stripWidth, bytes - x) };
+				box_blur::boxColumns(horizontal.ptr<uchar>() + x, horizontal.step, a.data(), stripWidth, src.rows,
+					width, widths[0] / 2, sums);
+				box_blur::boxColumns(a.data(), stripWidth, b.data(), stripWidth, src.rows, width, widths[1] / 2, sums);
+				box_blur::boxColumns(b.data(), stripWidth, dst.ptr<uchar>() + x, dst.step, src.rows, width,
+					widths[2] / 2, sums);
+			}
+		});
+}
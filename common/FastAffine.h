@@ -0,0 +1,138 @@
+/*
+ * warpAffine() with shortcuts for shifts by whole pixels and rotations by right angles.
+ *
+ * warpAffine() maps every output pixel back into the source image and interpolates between the four (or sixteen)
+ * pixels around that point, even when the point lands exactly on a pixel. Two kinds of transforms always land on
+ * pixels:
+ *	- a shift by a whole number of pixels: the output is the source copied to another place, and the uncovered part
+ *	  is filled with the border color;
+ *	- a rotation by 90, 180 or 270 degrees (scale 1) whose shift is a whole number of pixels: the output is a
+ *	  transpose and/or flip of the source (cv::rotate()), then shifted like above.
+ * warpAffineFast() recognizes both from the matrix and does them with plain copies, without any interpolation. Every
+ * other matrix goes to warpAffine(). The result is the same as warpAffine() with the same arguments, and the return
+ * value tells which way was taken.
+ *
+ * getRotationMatrix2D(center, 90, 1) gives cos 90 = 6e-17, not 0, so the matrix is compared with a small tolerance.
+ * The shortcuts are only taken with BORDER_CONSTANT, the border modes that copy source pixels into the border go to
+ * warpAffine().
+ */
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cmath>
+
+enum class AffinePath
+{
+	shift,     // copy with border fill
+	rotation,  // cv::rotate(), then a copy with border fill if there's a shift left
+	general    // cv::warpAffine()
+};
+
+inline const char* toString(AffinePath path)
+{
+	switch (path)
+	{
+	case AffinePath::shift: return "integer shift";
+	case AffinePath::rotation: return "right-angle rotation";
+	default: return "warpAffine";
+	}
+}
+
+namespace fast_affine
+{
+	inline bool near(double value, double target) { return std::abs(value - target) < 1e-9; }
+	inline bool whole(double value) { return std::abs(value - std::round(value)) < 1e-6; }
+
+	// dst = src moved by (dx, dy), dsize, with the rest filled with borderValue.
+	inline void shift(const cv::Mat& src, cv::Mat& dst, int dx, int dy, cv::Size dsize, const cv::Scalar& borderValue)
+	{
+		dst.create(dsize, src.type());
+		cv::Rect target{ cv::Rect(dx, dy, src.cols, src.rows) & cv::Rect(0, 0, dsize.width, dsize.height) };
+		// Fill only the part the source doesn't cover.
+		if (target.area() == 0)
+		{
+			dst.setTo(borderValue);
+			return;
+		}
+		dst.rowRange(0, target.y).setTo(borderValue);
+		dst.rowRange(target.y + target.height, dsize.height).setTo(borderValue);
+		dst(cv::Rect(0, target.y, target.x, target.height)).setTo(borderValue);
+		dst(cv::Rect(target.x + target.width, target.y, dsize.width - target.x - target.width, target.height))
+			.setTo(borderValue);
+		src(target - cv::Point(dx, dy)).copyTo(dst(target));
+	}
+}
+
+// Same as cv::warpAffine(src, dst, M, dsize, flags, borderMode, borderValue), without interpolation when M is a shift by
+// whole pixels or a rotation by a right angle.
+inline AffinePath warpAffineFast(const cv::Mat& src, cv::Mat& dst, const cv::Mat& M, cv::Size dsize,
+	int flags = cv::INTER_LINEAR, int borderMode = cv::BORDER_CONSTANT, const cv::Scalar& borderValue = cv::Scalar())
+{
+	CV_Assert(M.rows == 2 && M.cols == 3);
+	if (borderMode != cv::BORDER_CONSTANT || src.empty())
+	{
+		cv::warpAffine(src, dst, M, dsize, flags, borderMode, borderValue);
+		return AffinePath::general;
+	}
+
+	// The forward matrix, from source to output pixels.
+	cv::Mat forward;
+	M.convertTo(forward, CV_64F);
+	if (flags & cv::WARP_INVERSE_MAP)
+		cv::invertAffineTransform(forward, forward);
+	const double* m{ forward.ptr<double>() };
+	if (!fast_affine::whole(m[2]) || !fast_affine::whole(m[5]))
+	{
+		cv::warpAffine(src, dst, M, dsize, flags, borderMode, borderValue);
+		return AffinePath::general;
+	}
+	int tx{ static_cast<int>(std::round(m[2])) }, ty{ static_cast<int>(std::round(m[5])) };
+
+	using fast_affine::near;
+	if (dsize.empty())
+		dsize = src.size();
+	// The output may be the source itself.
+	cv::Mat source{ src.data == dst.data ? src.clone() : src };
+
+	if (near(m[0], 1) && near(m[1], 0) && near(m[3], 0) && near(m[4], 1))
+	{
+		fast_affine::shift(source, dst, tx, ty, dsize, borderValue);
+		return AffinePath::shift;
+	}
+
+	// cv::rotate() maps (x, y) to R * (x, y) + offset, the rest of the translation is a shift.
+	int code{ -1 };
+	cv::Point offset;
+	if (near(m[0], 0) && near(m[1], -1) && near(m[3], 1) && near(m[4], 0))
+	{
+		code = cv::ROTATE_90_CLOCKWISE; // (x, y) -> (rows - 1 - y, x)
+		offset = cv::Point(src.rows - 1, 0);
+	}
+	else if (near(m[0], 0) && near(m[1], 1) && near(m[3], -1) && near(m[4], 0))
+	{
+		code = cv::ROTATE_90_COUNTERCLOCKWISE; // (x, y) -> (y, cols - 1 - x)
+		offset = cv::Point(0, src.cols - 1);
+	}
+	else if (near(m[0], -1) && near(m[1], 0) && near(m[3], 0) && near(m[4], -1))
+	{
+		code = cv::ROTATE_180; // (x, y) -> (cols - 1 - x, rows - 1 - y)
+		offset = cv::Point(src.cols - 1, src.rows - 1);
+	}
+	if (code < 0)
+	{
+		cv::warpAffine(src, dst, M, dsize, flags, borderMode, borderValue);
+		return AffinePath::general;
+	}
+
+	int dx{ tx - offset.x }, dy{ ty - offset.y };
+	cv::Size rotatedSize{ code == cv::ROTATE_180 ? src.size() : cv::Size(src.rows, src.cols) };
+	if (dx == 0 && dy == 0 && dsize == rotatedSize)
+	{
+		cv::rotate(source, dst, code);
+		return AffinePath::rotation;
+	}
+	cv::Mat rotated;
+	cv::rotate(source, rotated, code);
+	fast_affine::shift(rotated, dst, dx, dy, dsize, borderValue);
+	return AffinePath::rotation;
+}
@@ -0,0 +1,329 @@
+/*
+ * Disk cache of decoded images, read back through memory mapping.
+ *
+ * Decoding a JPEG costs far more than copying its pixels, and a job that opens the same reference images over and over
+ * pays that cost every time. ImageCache keeps the decoded pixels of every image it reads in a file of its own in the
+ * cache directory. The next imread() of the same image, in this run or a later one, maps that file (MappedFile) and
+ * returns a cv::Mat whose data points straight into the mapping: no decoding and no copy.
+ *
+ * An entry is keyed by the absolute path, the modification time and size of the image file, and the imread flags, so
+ * an edited image or a different flag gets a new entry. A cache file is a small header, the image path, and the pixels
+ * rows after rows without gaps, starting at a 64-byte aligned offset (the mapping itself starts on a page boundary).
+ *
+ * The files together may take at most `maxBytes`. When a new entry goes over the budget, the least recently used
+ * files are deleted; a hit marks its file as used by updating its modification time. Files are written under a
+ * temporary name and renamed, so a crash never leaves half an entry behind, and several processes can share a cache
+ * directory.
+ *
+ * Every imread() maps the file anew, copy-on-write, so each returned image can be drawn on like any other: a page
+ * gets a private copy the first time it's written, and the changes are seen neither by the cache file nor by the
+ * images other imread() calls return (only by shallow copies of the same cv::Mat, as usual). The returned cv::Mat
+ * owns its mapping through a cv::MatAllocator: it stays valid after the ImageCache is gone, and the mapping is closed
+ * when the last copy of the cv::Mat is released. The cache itself keeps no mappings, so an evicted file stays on disk
+ * (or, on POSIX, occupies space) only while images mapped from it are still alive.
+ */
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "MappedFile.h"
+
+namespace image_cache
+{
+	// Lets a cv::Mat own a MappedFile: the mapping is closed when the Mat's reference count drops to zero. Only
+	// deallocate() is ours; Mats that allocate (e.g. create() with another size) get memory from the default allocator.
+	class MappingAllocator : public cv::MatAllocator
+	{
+	public:
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 2)
+		using Flags = cv::AccessFlag;
+#else
+		using Flags = int;
+#endif
+
+		cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, std::size_t* step, Flags flags,
+			cv::UMatUsageFlags usageFlags) const override
+		{
+			return cv::Mat::getDefaultAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+		}
+
+		bool allocate(cv::UMatData* data, Flags accessFlags, cv::UMatUsageFlags usageFlags) const override
+		{
+			return cv::Mat::getDefaultAllocator()->allocate(data, accessFlags, usageFlags);
+		}
+
+		void deallocate(cv::UMatData* data) const override
+		{
+			if (!data)
+				return;
+			CV_Assert(data->urefcount == 0 && data->refcount == 0);
+			delete static_cast<MappedFile*>(data->userdata);
+			delete data;
+		}
+
+		static const MappingAllocator* instance()
+		{
+			static MappingAllocator allocator;
+			return &allocator;
+		}
+	};
+
+	// A rows x cols image of `type` at `offset` in the mapping, owning the mapping.
+	inline cv::Mat adopt(std::unique_ptr<MappedFile> file, int rows, int cols, int type, std::size_t offset)
+	{
+		void* pixels{ static_cast<char*>(file->data()) + offset };
+		cv::Mat img(rows, cols, type, pixels);
+		auto* data{ new cv::UMatData(MappingAllocator::instance()) };
+		data->data = data->origdata = static_cast<uchar*>(pixels);
+		data->size = img.total() * img.elemSize();
+		data->userdata = file.release();
+		data->refcount = 1;
+		img.u = data;
+		img.allocator = MappingAllocator::instance();
+		return img;
+	}
+}
+
+class ImageCache
+{
+public:
+	explicit ImageCache(std::filesystem::path directory, std::uintmax_t maxBytes = 512ull << 20)
+		: directory_{ std::move(directory) }, maxBytes_{ maxBytes }
+	{
+		std::error_code ec;
+		std::filesystem::create_directories(directory_, ec);
+	}
+
+	ImageCache(const ImageCache&) = delete;
+	ImageCache& operator=(const ImageCache&) = delete;
+
+	// Same as cv::imread(path, flags), from the cache when possible. Falls back to a plain imread() if the cache
+	// directory can't be used.
+	cv::Mat imread(const std::string& path, int flags = cv::IMREAD_COLOR)
+	{
+		namespace fs = std::filesystem;
+		std::error_code ec;
+		fs::path source{ fs::absolute(path, ec) };
+		auto modified{ fs::last_write_time(source, ec) };
+		std::uintmax_t sourceSize{ ec ? 0 : fs::file_size(source, ec) };
+		if (ec)
+			return cv::imread(path, flags);
+
+		Key key{ source.string(), static_cast<std::int64_t>(modified.time_since_epoch().count()),
+			static_cast<std::uint64_t>(sourceSize), flags };
+		std::string name{ fileName(key) };
+
+		if (auto file{ openEntry(name, key) })
+		{
+			fs::last_write_time(directory_ / name, fs::file_time_type::clock::now(), ec);
+			std::lock_guard<std::mutex> lock{ mutex_ };
+			++hits_;
+			return view(std::move(file));
+		}
+		{
+			std::lock_guard<std::mutex> lock{ mutex_ };
+			++misses_;
+		}
+
+		// Decode without holding the lock, other threads can keep reading cached images in the meantime.
+		cv::Mat img{ cv::imread(path, flags) };
+		if (img.empty() || !writeEntry(name, key, img))
+			return img;
+
+		{
+			std::lock_guard<std::mutex> lock{ mutex_ };
+			evict(name);
+		}
+		// This call has the decoded pixels already, the mapping only pays off for the next reads.
+		return img;
+	}
+
+	std::int64_t hits() const { std::lock_guard<std::mutex> lock{ mutex_ }; return hits_; }
+	std::int64_t misses() const { std::lock_guard<std::mutex> lock{ mutex_ }; return misses_; }
+	std::int64_t evictions() const { std::lock_guard<std::mutex> lock{ mutex_ }; return evictions_; }
+
+	// Bytes taken by the cache files.
+	std::uintmax_t bytes() const
+	{
+		std::uintmax_t total{ 0 };
+		for (const auto& entry : entries())
+			total += entry.bytes;
+		return total;
+	}
+
+private:
+	struct Key
+	{
+		std::string path;
+		std::int64_t modified;
+		std::uint64_t size;
+		int flags;
+	};
+
+	struct Header
+	{
+		char magic[8];
+		std::int64_t modified;
+		std::uint64_t sourceSize;
+		std::int32_t flags, rows, cols, type;
+		std::uint32_t pathLength;
+		std::uint32_t dataOffset;
+	};
+
+	struct Entry
+	{
+		std::filesystem::path path;
+		std::filesystem::file_time_type used;
+		std::uintmax_t bytes;
+	};
+
+	static constexpr char magic[8]{ 'I', 'M', 'G', 'C', 'A', 'C', 'H', '1' };
+	static constexpr char extension[]{ ".img" };
+
+	static std::string fileName(const Key& key)
+	{
+		std::ostringstream text;
+		text << key.path << '|' << key.modified << '|' << key.size << '|' << key.flags;
+		std::ostringstream name;
+		name << std::hex << std::hash<std::string>{}(text.str()) << extension;
+		return name.str();
+	}
+
+	// The pixels of a mapped entry, without copying them. The image owns the mapping.
+	static cv::Mat view(std::unique_ptr<MappedFile> file)
+	{
+		const Header header{ *static_cast<const Header*>(file->data()) };
+		return image_cache::adopt(std::move(file), header.rows, header.cols, header.type, header.dataOffset);
+	}
+
+	// Maps the cache file `name`, copy-on-write, if it exists and belongs to `key`.
+	std::unique_ptr<MappedFile> openEntry(const std::string& name, const Key& key) const
+	{
+		auto file{ std::make_unique<MappedFile>() };
+		if (!file->open((directory_ / name).string(), true) || file->size() < sizeof(Header))
+			return nullptr;
+
+		const auto* header{ static_cast<const Header*>(file->data()) };
+		const char* base{ static_cast<const char*>(file->data()) };
+		if (std::memcmp(header->magic, magic, sizeof(magic)) != 0 || header->modified != key.modified ||
+			header->sourceSize != key.size || header->flags != key.flags || header->pathLength != key.path.size() ||
+			sizeof(Header) + header->pathLength > file->size() ||
+			key.path.compare(0, key.path.size(), base + sizeof(Header), header->pathLength) != 0)
+			return nullptr;
+
+		std::size_t pixels{ static_cast<std::size_t>(header->rows) * header->cols * CV_ELEM_SIZE(header->type) };
+		if (header->dataOffset + pixels != file->size())
+			return nullptr;
+		return file;
+	}
+
+	bool writeEntry(const std::string& name, const Key& key, const cv::Mat& img) const
+	{
+		Header header{};
+		std::memcpy(header.magic, magic, sizeof(magic));
+		header.modified = key.modified;
+		header.sourceSize = key.size;
+		header.flags = key.flags;
+		header.rows = img.rows;
+		header.cols = img.cols;
+		header.type = img.type();
+		header.pathLength = static_cast<std::uint32_t>(key.path.size());
+		// Pixels start on a cache line, so SIMD loads of the first row are aligned.
+		header.dataOffset = static_cast<std::uint32_t>((sizeof(Header) + key.path.size() + 63) / 64 * 64);
+
+		// A temporary name no other writer uses at the same moment, renamed into place when complete.
+		std::ostringstream temporary;
+		temporary << name << '.' << std::hash<std::thread::id>{}(std::this_thread::get_id()) << '.'
+			<< std::chrono::steady_clock::now().time_since_epoch().count() << ".tmp";
+		std::filesystem::path temporaryPath{ directory_ / temporary.str() };
+
+		{
+			std::ofstream out{ temporaryPath, std::ios::binary };
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(key.path.data(), static_cast<std::streamsize>(key.path.size()));
+			std::vector<char> padding(header.dataOffset - sizeof(header) - key.path.size(), 0);
+			out.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+			std::size_t rowBytes{ img.cols * img.elemSize() };
+			for (int y{ 0 }; y < img.rows; ++y)
+				out.write(img.ptr<char>(y), static_cast<std::streamsize>(rowBytes));
+			if (!out)
+			{
+				out.close();
+				std::remove(temporaryPath.string().c_str());
+				return false;
+			}
+		}
+
+		std::error_code ec;
+		std::filesystem::rename(temporaryPath, directory_ / name, ec);
+		if (ec)
+			std::filesystem::remove(temporaryPath, ec);
+		return !ec;
+	}
+
+	std::vector<Entry> entries() const
+	{
+		std::vector<Entry> result;
+		std::error_code ec;
+		for (const auto& item : std::filesystem::directory_iterator(directory_, ec))
+		{
+			if (item.path().extension() != extension)
+				continue;
+			std::error_code itemEc;
+			Entry entry{ item.path(), item.last_write_time(itemEc), item.file_size(itemEc) };
+			if (!itemEc)
+				result.push_back(entry);
+		}
+		return result;
+	}
+
+	// Deletes the least recently used cache files until they fit in the budget. `keep` is the entry just written.
+	// Images still mapped from a deleted file stay readable: on POSIX the mapping keeps the data alive and the disk
+	// space comes back when the last of those images is released. Windows refuses to delete a mapped file; it's
+	// retried at the next eviction, by which time the images are usually gone.
+	void evict(const std::string& keep)
+	{
+		std::vector<Entry> all{ entries() };
+		std::uintmax_t total{ 0 };
+		for (const auto& entry : all)
+			total += entry.bytes;
+		if (total <= maxBytes_)
+			return;
+
+		std::sort(all.begin(), all.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+		for (const auto& entry : all)
+		{
+			if (total <= maxBytes_)
+				break;
+			if (entry.path.filename() == keep)
+				continue;
+			std::error_code ec;
+			if (std::filesystem::remove(entry.path, ec))
+			{
+				total -= entry.bytes;
+				++evictions_;
+			}
+		}
+	}
+
+	std::filesystem::path directory_;
+	std::uintmax_t maxBytes_;
+
+	mutable std::mutex mutex_;
+	std::int64_t hits_{ 0 }, misses_{ 0 }, evictions_{ 0 };
+};
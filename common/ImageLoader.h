@@ -0,0 +1,133 @@
+/*
+ * Image loading straight to a smaller size.
+ *
+ * The lessons read a photo with imread() and shrink it right away with resize(). For a JPEG that means decoding every
+ * pixel at full resolution, only to throw most of them away. But a JPEG stores its pixels as 8x8 blocks of DCT
+ * coefficients, and the decoder can turn a block into 4x4, 2x2 or a single pixel by using only the low frequencies
+ * (IMREAD_REDUCED_COLOR_2/4/8). That skips most of the decoding work, and the full-size image never exists in memory.
+ *
+ * loadImage() reads the width and height from the JPEG header, picks the largest reduction whose result is still at
+ * least as big as the requested size, and finishes with a small resize() (INTER_AREA) to the exact size. Other
+ * formats, other flags than IMREAD_COLOR / IMREAD_GRAYSCALE, and sizes too big for any reduction are decoded at full
+ * resolution and resized, so the result always has the size imread() + resize() would give, only cheaper when
+ * possible.
+ */
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <fstream>
+#include <string>
+
+// Width and height from the frame header (SOF marker) of a JPEG file, without decoding it. An empty size if the file
+// isn't a JPEG or the header is damaged.
+inline cv::Size jpegSize(const std::string& path)
+{
+	std::ifstream in{ path, std::ios::binary };
+	auto byte{ [&in]() { return in.get(); } };
+	auto word{ [&in]() { int high{ in.get() }; return (high << 8) | in.get(); } };
+
+	if (byte() != 0xFF || byte() != 0xD8)
+		return {};
+	while (in)
+	{
+		if (byte() != 0xFF)
+			return {};
+		int marker{ byte() };
+		while (marker == 0xFF) // fill bytes
+			marker = byte();
+		// Markers without a length
+		if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+			continue;
+		int length{ word() };
+		if (!in || length < 2)
+			return {};
+		// SOF0..SOF15, except DHT (C4), JPG (C8) and DAC (CC)
+		if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+		{
+			byte(); // precision
+			int height{ word() };
+			int width{ word() };
+			return in ? cv::Size(width, height) : cv::Size();
+		}
+		// Start of scan or end of image before any frame header
+		if (marker == 0xDA || marker == 0xD9)
+			return {};
+		in.seekg(length - 2, std::ios::cur);
+	}
+	return {};
+}
+
+namespace image_loader
+{
+	// The largest DCT reduction (1, 2, 4 or 8) of an image of size `full` that keeps it at least `minimum` in both sides.
+	inline int reductionFor(cv::Size full, cv::Size minimum)
+	{
+		// The decoder rounds up, an 8x reduction of 1389 pixels gives 174.
+		for (int d : { 8, 4, 2 })
+		{
+			if ((full.width + d - 1) / d >= minimum.width && (full.height + d - 1) / d >= minimum.height)
+				return d;
+		}
+		return 1;
+	}
+
+	// Decodes `path` with the largest DCT reduction that keeps the image at least `minimum` (in the orientation of the
+	// JPEG header) in both sides. `full` is the size from the header. No reduction for other flags or formats.
+	inline cv::Mat decodeReduced(const std::string& path, int flags, cv::Size full, cv::Size minimum)
+	{
+		int reduction{ 1 };
+		if (!full.empty() && (flags == cv::IMREAD_COLOR || flags == cv::IMREAD_GRAYSCALE))
+			reduction = reductionFor(full, minimum);
+		if (reduction == 1)
+			return cv::imread(path, flags);
+
+		bool gray{ flags == cv::IMREAD_GRAYSCALE };
+		int reducedFlag{ reduction == 8 ? (gray ? cv::IMREAD_REDUCED_GRAYSCALE_8 : cv::IMREAD_REDUCED_COLOR_8)
+			: reduction == 4 ? (gray ? cv::IMREAD_REDUCED_GRAYSCALE_4 : cv::IMREAD_REDUCED_COLOR_4)
+			: (gray ? cv::IMREAD_REDUCED_GRAYSCALE_2 : cv::IMREAD_REDUCED_COLOR_2) };
+		return cv::imread(path, reducedFlag);
+	}
+
+	// True if the EXIF orientation turned the image by 90 degrees while decoding.
+	inline bool turned(const cv::Mat& img, cv::Size full)
+	{
+		return full.width != full.height && (img.cols > img.rows) != (full.width > full.height);
+	}
+}
+
+// Reads the image at `path` resized to `size`, like imread(path, flags) followed by resize(img, img, size) with
+// INTER_AREA. Returns an empty Mat if the file can't be read.
+inline cv::Mat loadImage(const std::string& path, cv::Size size, int flags = cv::IMREAD_COLOR)
+{
+	// The EXIF orientation may swap width and height while decoding, so the reduced image must fit either way round.
+	cv::Size full{ jpegSize(path) };
+	int side{ std::max(size.width, size.height) };
+	cv::Mat img{ image_loader::decodeReduced(path, flags, full, cv::Size(side, side)) };
+	if (img.empty() || img.size() == size)
+		return img;
+	cv::Mat resized;
+	cv::resize(img, resized, size, 0, 0, cv::INTER_AREA);
+	return resized;
+}
+
+// Reads the image at `path` scaled by fx and fy, like imread(path, flags) followed by
+// resize(img, img, cv::Size(), fx, fy) with INTER_AREA.
+inline cv::Mat loadImage(const std::string& path, double fx, double fy, int flags = cv::IMREAD_COLOR)
+{
+	cv::Size full{ jpegSize(path) };
+	// The size resize() would compute from the full-resolution image, for both orientations.
+	cv::Size size{ cv::saturate_cast<int>(full.width * fx), cv::saturate_cast<int>(full.height * fy) };
+	cv::Size turnedSize{ cv::saturate_cast<int>(full.height * fx), cv::saturate_cast<int>(full.width * fy) };
+	cv::Size minimum{ std::max(size.width, turnedSize.height), std::max(size.height, turnedSize.width) };
+
+	cv::Mat img{ image_loader::decodeReduced(path, flags, full, minimum) };
+	if (img.empty())
+		return img;
+	cv::Mat resized;
+	if (full.empty())
+		cv::resize(img, resized, cv::Size(), fx, fy, cv::INTER_AREA); // not a JPEG, decoded at full size
+	else
+		cv::resize(img, resized, image_loader::turned(img, full) ? turnedSize : size, 0, 0, cv::INTER_AREA);
+	return resized;
+}
@@ -0,0 +1,140 @@
+/*
+ * Decoding only a rectangle of a JPEG file.
+ *
+ * To warp a document out of a big photo, imread() decodes all of it, although warpPerspective() only reads the pixels
+ * inside the document's quad. libjpeg-turbo can skip most of the work for the rest:
+ *	- jpeg_skip_scanlines() jumps over the rows above the rectangle. Their data still has to be unpacked (Huffman
+ *	  decoded) to find where the next row starts, but the expensive steps, the inverse DCT, upsampling and color
+ *	  conversion, are skipped.
+ *	- jpeg_crop_scanline() limits the rows that are decoded to the columns of the rectangle, widened to whole MCUs
+ *	  (the 8x8 or 16x16 pixel blocks the JPEG is made of), since a block can only be decoded as a whole.
+ *	- Decoding stops after the last row of the rectangle.
+ * Only the rectangle (plus up to one MCU on the left and right) is ever held in memory.
+ *
+ * The decoded image usually starts a little left of the rectangle, so loadJpegRegion() reports where its top-left
+ * pixel is in the full image. Subtracting that origin from the quad corners before getPerspectiveTransform() gives
+ * the same warp as with the full image. jpegRegionFor() gives the rectangle a quad needs, including the neighbors
+ * the interpolation reads.
+ *
+ * The fast path calls libjpeg-turbo directly, so it's opt-in: compile with -DJPEG_REGION_TURBO and link with -ljpeg.
+ * (The libjpeg-turbo headers are often installed along with OpenCV, but OpenCV doesn't export the jpeg_* functions,
+ * so turning the fast path on just because the header exists would break the link.) Without it, or for files it
+ * can't decode to BGR (e.g. CMYK), loadJpegRegion() falls back to imread() and returns the rectangle of the full
+ * image. Both ways ignore the EXIF orientation, so the rectangle, the origin and the quad are always in the
+ * coordinates of the image as it's stored, which can differ from plain imread() for photos taken in portrait.
+ */
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include <csetjmp>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#ifdef JPEG_REGION_TURBO
+#include <jpeglib.h>
+#if !defined(LIBJPEG_TURBO_VERSION) || !defined(JCS_EXTENSIONS)
+#error "JPEG_REGION_TURBO needs the libjpeg-turbo headers (jpeg_crop_scanline, JCS_EXT_BGR)"
+#endif
+#endif
+
+// The rectangle of the full image that warping `quad` reads: its bounding box plus the pixels the interpolation
+// needs around it.
+inline cv::Rect jpegRegionFor(const std::vector<cv::Point2f>& quad, int margin = 2)
+{
+	cv::Rect box{ cv::boundingRect(quad) };
+	return cv::Rect(box.x - margin, box.y - margin, box.width + 2 * margin, box.height + 2 * margin);
+}
+
+namespace jpeg_region
+{
+	// imread() and the rectangle of the full image, in the stored orientation like the fast path.
+	inline cv::Mat loadFull(const std::string& path, cv::Rect region, cv::Point& origin)
+	{
+		cv::Mat img{ cv::imread(path, cv::IMREAD_COLOR | cv::IMREAD_IGNORE_ORIENTATION) };
+		cv::Rect bounds{ region & cv::Rect(0, 0, img.cols, img.rows) };
+		origin = bounds.tl();
+		return bounds.empty() ? cv::Mat() : img(bounds);
+	}
+
+#ifdef JPEG_REGION_TURBO
+	// libjpeg calls error_exit() on errors and expects it not to return.
+	struct ErrorManager
+	{
+		jpeg_error_mgr base;
+		std::jmp_buf jump;
+	};
+
+	inline void onError(j_common_ptr info) { std::longjmp(reinterpret_cast<ErrorManager*>(info->err)->jump, 1); }
+	inline void onMessage(j_common_ptr) {}
+
+	// Decodes `region` of an opened file. Returns false on any libjpeg error.
+	inline bool decode(std::FILE* file, cv::Rect region, cv::Mat& img, cv::Point& origin)
+	{
+		jpeg_decompress_struct info;
+		ErrorManager error;
+		info.err = jpeg_std_error(&error.base);
+		error.base.error_exit = onError;
+		error.base.output_message = onMessage;
+		// Everything that has to be cleaned up after an error is declared above this line.
+		if (setjmp(error.jump))
+		{
+			jpeg_destroy_decompress(&info);
+			return false;
+		}
+
+		jpeg_create_decompress(&info);
+		jpeg_stdio_src(&info, file);
+		jpeg_read_header(&info, TRUE);
+		info.out_color_space = JCS_EXT_BGR;
+		jpeg_start_decompress(&info);
+
+		cv::Rect bounds{ region & cv::Rect(0, 0, static_cast<int>(info.output_width),
+			static_cast<int>(info.output_height)) };
+		if (bounds.empty())
+		{
+			jpeg_destroy_decompress(&info);
+			img.release();
+			origin = bounds.tl();
+			return true;
+		}
+
+		// Moves x left to an MCU boundary and widens the row to match.
+		JDIMENSION x{ static_cast<JDIMENSION>(bounds.x) }, width{ static_cast<JDIMENSION>(bounds.width) };
+		jpeg_crop_scanline(&info, &x, &width);
+		jpeg_skip_scanlines(&info, static_cast<JDIMENSION>(bounds.y));
+
+		img.create(bounds.height, static_cast<int>(width), CV_8UC3);
+		while (info.output_scanline < static_cast<JDIMENSION>(bounds.y + bounds.height))
+		{
+			JSAMPROW row{ img.ptr<JSAMPLE>(static_cast<int>(info.output_scanline) - bounds.y) };
+			jpeg_read_scanlines(&info, &row, 1);
+		}
+		// The rows below the rectangle are never decoded.
+		jpeg_abort_decompress(&info);
+		jpeg_destroy_decompress(&info);
+		origin = cv::Point(static_cast<int>(x), bounds.y);
+		return true;
+	}
+#endif
+}
+
+// Decodes the part of the JPEG at `path` that covers `region` as an 8-bit BGR image. `origin` receives the position of
+// the returned image's top-left pixel in the full image. Returns an empty Mat if the file can't be read or the region
+// is outside the image.
+inline cv::Mat loadJpegRegion(const std::string& path, cv::Rect region, cv::Point& origin)
+{
+#ifdef JPEG_REGION_TURBO
+	std::FILE* file{ std::fopen(path.c_str(), "rb") };
+	if (file)
+	{
+		cv::Mat img;
+		bool decoded{ jpeg_region::decode(file, region, img, origin) };
+		std::fclose(file);
+		if (decoded)
+			return img;
+	}
+#endif
+	return jpeg_region::loadFull(path, region, origin);
+}
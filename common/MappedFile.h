@@ -0,0 +1,135 @@
+/*
+ * A whole file mapped read-only into memory.
+ *
+ * The operating system loads the pages of the file only when they are touched, and every process that maps the same
+ * file shares the same physical pages. Nothing is read or copied up front, so opening even a large file is almost
+ * free. Uses mmap() on POSIX systems and MapViewOfFile() on Windows.
+ *
+ * A copy-on-write mapping can also be written to: a page gets a private copy the first time it's changed, and the
+ * file itself is never modified.
+ */
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+// Keep windows.h from defining min and max macros (which break std::min and std::max in every file that includes
+// this header) and from pulling in the rarely used parts of the API.
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile() { close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+	MappedFile& operator=(MappedFile&& other) noexcept
+	{
+		if (this != &other)
+		{
+			close();
+#ifdef _WIN32
+			std::swap(file_, other.file_);
+			std::swap(mapping_, other.mapping_);
+#endif
+			std::swap(data_, other.data_);
+			std::swap(size_, other.size_);
+		}
+		return *this;
+	}
+
+	// Maps the file. Returns false if it doesn't exist, is empty or can't be mapped.
+	bool open(const std::string& path, bool copyOnWrite = false)
+	{
+		close();
+#ifdef _WIN32
+		file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+			nullptr);
+		if (file_ == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file_, &fileSize) || fileSize.QuadPart == 0)
+		{
+			close();
+			return false;
+		}
+		size_ = static_cast<std::size_t>(fileSize.QuadPart);
+		mapping_ = CreateFileMappingA(file_, nullptr, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr);
+		data_ = mapping_ ? MapViewOfFile(mapping_, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (!data_)
+			close();
+		return data_ != nullptr;
+#else
+		int fd{ ::open(path.c_str(), O_RDONLY) };
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			::close(fd);
+			return false;
+		}
+		void* data{ copyOnWrite
+			? mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)
+			: mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0) };
+		// The mapping stays valid after the descriptor is closed.
+		::close(fd);
+		if (data == MAP_FAILED)
+			return false;
+		data_ = data;
+		size_ = static_cast<std::size_t>(st.st_size);
+		return true;
+#endif
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (data_)
+			UnmapViewOfFile(data_);
+		if (mapping_)
+			CloseHandle(mapping_);
+		if (file_ != INVALID_HANDLE_VALUE)
+			CloseHandle(file_);
+		mapping_ = nullptr;
+		file_ = INVALID_HANDLE_VALUE;
+#else
+		if (data_)
+			munmap(data_, size_);
+#endif
+		data_ = nullptr;
+		size_ = 0;
+	}
+
+	bool isOpen() const { return data_ != nullptr; }
+	const void* data() const { return data_; }
+	// Only write through this pointer to a copy-on-write mapping.
+	void* data() { return data_; }
+	std::size_t size() const { return size_; }
+
+private:
+#ifdef _WIN32
+	HANDLE file_{ INVALID_HANDLE_VALUE };
+	HANDLE mapping_{ nullptr };
+#endif
+	void* data_{ nullptr };
+	std::size_t size_{ 0 };
+};
@@ -0,0 +1,18 @@
+/*
+ * Percentiles of timing samples, e.g. the p50/p95/p99 frame latencies printed by 02a_reading_videos and
+ * 02b_reading_from_webcam.
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+// Value below which `p` percent of the sorted samples lie (nearest rank).
+inline double percentile(const std::vector<double>& sorted, double p)
+{
+	if (sorted.empty())
+		return 0;
+	std::size_t rank{ static_cast<std::size_t>(p / 100.0 * sorted.size() + 0.5) };
+	return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
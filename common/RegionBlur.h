@@ -0,0 +1,111 @@
+/*
+ * Blurring only parts of an image, e.g. the faces found by 17_face_detection.
+ *
+ * To hide a few faces, blurring the whole frame and copying the faces back costs as much as the frame is big.
+ * blurRegions() blurs only around the rectangles: each rectangle is enlarged by the distance the blur reads from
+ * (box_blur::reach()), rectangles whose enlarged areas overlap are merged into one, and every merged area is blurred
+ * with boxBlur() on its own. Inside the rectangles the result is exactly what boxBlur() of the whole image gives, and
+ * the cost grows with the area covered, not with the frame. The pixels outside the rectangles don't change.
+ *
+ * blurMask() does the same for the nonzero pixels of a mask: it finds the bounding rectangles of the mask's blobs,
+ * blurs around them, and writes back only the pixels under the mask. Finding the blobs is one quick pass over the
+ * mask, the blur itself again only covers the blobs.
+ *
+ * Both work in place. The merged areas don't overlap, so they're blurred in parallel.
+ */
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include "BoxBlur.h"
+
+namespace region_blur
+{
+	// An area to blur: the enlarged rectangle and the original rectangles inside it.
+	struct Area
+	{
+		cv::Rect padded;
+		std::vector<cv::Rect> inner;
+	};
+
+	// Enlarges every rectangle by `pad`, clips it to the image, and merges the ones that overlap.
+	inline std::vector<Area> mergeAreas(const std::vector<cv::Rect>& rects, int pad, cv::Size size)
+	{
+		const cv::Rect image{ 0, 0, size.width, size.height };
+		std::vector<Area> areas;
+		for (const cv::Rect& r : rects)
+		{
+			cv::Rect inner{ r & image };
+			if (inner.empty())
+				continue;
+			Area area{ cv::Rect(inner.x - pad, inner.y - pad, inner.width + 2 * pad, inner.height + 2 * pad) & image,
+				{ inner } };
+			// Merging can make an area overlap one it didn't before, so repeat until nothing overlaps the new one.
+			for (bool merged{ true }; merged;)
+			{
+				merged = false;
+				for (std::size_t i{ 0 }; i < areas.size(); ++i)
+				{
+					if ((areas[i].padded & area.padded).empty())
+						continue;
+					area.padded |= areas[i].padded;
+					area.inner.insert(area.inner.end(), areas[i].inner.begin(), areas[i].inner.end());
+					areas.erase(areas.begin() + static_cast<std::ptrdiff_t>(i));
+					merged = true;
+					break;
+				}
+			}
+			areas.push_back(std::move(area));
+		}
+		return areas;
+	}
+
+	// Blurs every area and hands the blurred copy of it to writeBack(area, blurred).
+	template <typename WriteBack>
+	void blurAreas(const cv::Mat& img, const std::vector<Area>& areas, int ksize, double sigma, WriteBack writeBack)
+	{
+		cv::parallel_for_(cv::Range(0, static_cast<int>(areas.size())), [&](const cv::Range& range)
+			{
+				cv::Mat blurred;
+				for (int i{ range.start }; i < range.end; ++i)
+				{
+					boxBlur(img(areas[i].padded), blurred, ksize, sigma);
+					writeBack(areas[i], blurred);
+				}
+			});
+	}
+}
+
+// Blurs the rectangles of img in place, like boxBlur() of the whole image copied back only inside the rectangles.
+inline void blurRegions(cv::Mat& img, const std::vector<cv::Rect>& rects, int ksize, double sigma = 0)
+{
+	std::vector<region_blur::Area> areas{ region_blur::mergeAreas(rects, box_blur::reach(ksize, sigma), img.size()) };
+	region_blur::blurAreas(img, areas, ksize, sigma, [&img](const region_blur::Area& area, const cv::Mat& blurred)
+		{
+			for (const cv::Rect& r : area.inner)
+				blurred(r - area.padded.tl()).copyTo(img(r));
+		});
+}
+
+// Blurs the pixels of img where mask (CV_8UC1, the size of img) isn't zero, in place.
+inline void blurMask(cv::Mat& img, const cv::Mat& mask, int ksize, double sigma = 0)
+{
+	CV_Assert(mask.type() == CV_8UC1 && mask.size() == img.size());
+	cv::Mat labels, stats, centroids;
+	int count{ cv::connectedComponentsWithStats(mask, labels, stats, centroids, 8, CV_32S) };
+	std::vector<cv::Rect> rects;
+	for (int i{ 1 }; i < count; ++i) // label 0 is the background
+	{
+		const int* s{ stats.ptr<int>(i) };
+		rects.emplace_back(s[cv::CC_STAT_LEFT], s[cv::CC_STAT_TOP], s[cv::CC_STAT_WIDTH], s[cv::CC_STAT_HEIGHT]);
+	}
+
+	std::vector<region_blur::Area> areas{ region_blur::mergeAreas(rects, box_blur::reach(ksize, sigma), img.size()) };
+	region_blur::blurAreas(img, areas, ksize, sigma, [&](const region_blur::Area& area, const cv::Mat& blurred)
+		{
+			for (const cv::Rect& r : area.inner)
+				blurred(r - area.padded.tl()).copyTo(img(r), mask(r));
+		});
+}
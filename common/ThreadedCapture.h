@@ -0,0 +1,292 @@
+/*
+ * Video capture that decodes on its own thread into a ring of reusable frame buffers.
+ *
+ * With cap.read() in the processing loop, the time to decode a frame and the time to process it add up. ThreadedCapture
+ * decodes on a dedicated thread, so the next frame is decoded while the current one is processed. The frames are
+ * decoded into a fixed pool of cv::Mat buffers that are reused over and over: once the first frames have been read,
+ * no frame allocates memory any more.
+ *
+ * next() hands out a CapturedFrame, which borrows one buffer of the pool without copying it. The buffer goes back to
+ * the pool when the CapturedFrame is destroyed (or release() is called), so keep it only as long as you need the
+ * image and clone() the image if you want to keep it longer.
+ *
+ * When processing is slower than decoding all buffers fill up, and the policy decides what happens:
+ *	block        the decoder waits for a free buffer, no frame is lost (right for files)
+ *	dropOldest   the oldest decoded frame that wasn't handed out yet is dropped, so we always get the newest frames
+ *	dropNewest   the frame just decoded is dropped, the frames already waiting are kept
+ *	latestOnly   only the newest decoded frame is kept, every older waiting frame is dropped as soon as a new one
+ *	             arrives (at least 3 buffers: one for the caller, one for the newest frame, one to decode into)
+ * depth() is the number of decoded frames waiting, dropped() counts the frames lost by the policy.
+ *
+ * A video file can stand in for a camera: with `loop` it starts over at the end, and with `pace` set to the frame
+ * rate it delivers the frames in real time instead of as fast as it can decode them.
+ */
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class DropPolicy
+{
+	block,
+	dropOldest,
+	dropNewest,
+	latestOnly
+};
+
+class ThreadedCapture;
+
+// A decoded frame borrowed from a ThreadedCapture. It must not outlive the capture it came from.
+class CapturedFrame
+{
+public:
+	CapturedFrame() = default;
+	~CapturedFrame() { release(); }
+
+	CapturedFrame(const CapturedFrame&) = delete;
+	CapturedFrame& operator=(const CapturedFrame&) = delete;
+
+	CapturedFrame(CapturedFrame&& other) noexcept { *this = std::move(other); }
+	CapturedFrame& operator=(CapturedFrame&& other) noexcept
+	{
+		if (this != &other)
+		{
+			release();
+			std::swap(owner_, other.owner_);
+			std::swap(slot_, other.slot_);
+			std::swap(image_, other.image_);
+			index_ = other.index_;
+			captured_ = other.captured_;
+		}
+		return *this;
+	}
+
+	// Returns the buffer to the capture. The frame is empty afterwards.
+	void release();
+
+	explicit operator bool() const { return owner_ != nullptr; }
+
+	// The decoded image. It's a view of the buffer, valid until the frame is released.
+	const cv::Mat& image() const { return image_; }
+	// Position of the frame in the stream, counting dropped frames too.
+	std::int64_t index() const { return index_; }
+	// When the decoder asked for the frame: just before the read() that delivered it, so the time to grab and
+	// decode it is included. The time the frame waited in the camera driver before that read() can't be seen.
+	std::chrono::steady_clock::time_point captured() const { return captured_; }
+
+private:
+	friend class ThreadedCapture;
+
+	ThreadedCapture* owner_{ nullptr };
+	int slot_{ -1 };
+	cv::Mat image_;
+	std::int64_t index_{ 0 };
+	std::chrono::steady_clock::time_point captured_;
+};
+
+class ThreadedCapture
+{
+public:
+	explicit ThreadedCapture(int buffers = 4, DropPolicy policy = DropPolicy::block)
+		: slots_(std::max(policy == DropPolicy::latestOnly ? 3 : 1, buffers)), indices_(slots_.size()),
+		stamps_(slots_.size()), policy_{ policy }
+	{
+		for (int i{ static_cast<int>(slots_.size()) - 1 }; i >= 0; --i)
+			free_.push_back(i);
+	}
+
+	~ThreadedCapture() { stop(); }
+
+	ThreadedCapture(const ThreadedCapture&) = delete;
+	ThreadedCapture& operator=(const ThreadedCapture&) = delete;
+
+	// Opens a video file, or a camera if the source is a plain number.
+	bool open(const std::string& source)
+	{
+		if (!source.empty() && std::all_of(source.begin(), source.end(), [](unsigned char c) { return std::isdigit(c); }))
+			cap_.open(std::stoi(source));
+		else
+			cap_.open(source);
+		return cap_.isOpened();
+	}
+
+	// The underlying capture, e.g. for get()/set() of properties. Don't use it after start().
+	cv::VideoCapture& capture() { return cap_; }
+
+	// Start a file over at its end instead of stopping. Set before start().
+	bool loop{ false };
+	// Deliver at most this many frames per second, like a camera would (0: as fast as possible). Set before start().
+	double pace{ 0 };
+
+	void start()
+	{
+		if (!thread_.joinable())
+			thread_ = std::thread{ [this] { run(); } };
+	}
+
+	// Stops the decoder. Frames that are already decoded can still be taken with next().
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock{ mutex_ };
+			stopping_ = true;
+			slotFree_.notify_all();
+		}
+		if (thread_.joinable())
+			thread_.join();
+	}
+
+	// Waits for the next decoded frame. Returns an empty frame at the end of the stream.
+	CapturedFrame next()
+	{
+		CapturedFrame frame;
+		std::unique_lock<std::mutex> lock{ mutex_ };
+		frameReady_.wait(lock, [this] { return finished_ || !ready_.empty(); });
+		if (ready_.empty())
+			return frame;
+
+		int slot{ ready_.front() };
+		ready_.pop_front();
+		frame.owner_ = this;
+		frame.slot_ = slot;
+		frame.image_ = slots_[slot];
+		frame.index_ = indices_[slot];
+		frame.captured_ = stamps_[slot];
+		return frame;
+	}
+
+	int capacity() const { return static_cast<int>(slots_.size()); }
+	int depth() const { std::lock_guard<std::mutex> lock{ mutex_ }; return static_cast<int>(ready_.size()); }
+	int maxDepth() const { std::lock_guard<std::mutex> lock{ mutex_ }; return maxDepth_; }
+	std::int64_t decoded() const { std::lock_guard<std::mutex> lock{ mutex_ }; return decoded_; }
+	std::int64_t dropped() const { std::lock_guard<std::mutex> lock{ mutex_ }; return dropped_; }
+
+private:
+	friend class CapturedFrame;
+
+	void run()
+	{
+		bool dropsOldest{ policy_ == DropPolicy::dropOldest || policy_ == DropPolicy::latestOnly };
+		auto period{ std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(pace > 0 ? 1.0 / pace : 0.0)) };
+		auto due{ std::chrono::steady_clock::now() };
+
+		for (std::int64_t index{ 0 }; ; ++index)
+		{
+			// Pick the buffer to decode into. -1 means no buffer is free and the policy drops the new frame.
+			int slot{ -1 };
+			{
+				std::unique_lock<std::mutex> lock{ mutex_ };
+				if (policy_ != DropPolicy::dropNewest)
+				{
+					slotFree_.wait(lock, [this, dropsOldest]
+						{
+							return stopping_ || !free_.empty() || (dropsOldest && !ready_.empty());
+						});
+				}
+				if (stopping_)
+					break;
+				if (!free_.empty())
+				{
+					slot = free_.back();
+					free_.pop_back();
+				}
+				else if (dropsOldest)
+				{
+					slot = ready_.front();
+					ready_.pop_front();
+					++dropped_;
+				}
+			}
+
+			if (pace > 0)
+			{
+				std::this_thread::sleep_until(due);
+				due = std::max(due + period, std::chrono::steady_clock::now() - period);
+			}
+
+			// Decode without holding the lock. The buffers keep their size, so read() reuses their memory. The stamp
+			// is taken before read(), so the latency measured from it includes grabbing and decoding the frame.
+			cv::Mat& target{ slot >= 0 ? slots_[slot] : discard_ };
+			auto stamp{ std::chrono::steady_clock::now() };
+			bool ok{ cap_.read(target) && !target.empty() };
+			if (!ok && loop)
+			{
+				cap_.set(cv::CAP_PROP_POS_FRAMES, 0);
+				stamp = std::chrono::steady_clock::now();
+				ok = cap_.read(target) && !target.empty();
+			}
+
+			std::lock_guard<std::mutex> lock{ mutex_ };
+			if (!ok)
+			{
+				if (slot >= 0)
+					free_.push_back(slot);
+				break;
+			}
+			++decoded_;
+			if (slot < 0)
+			{
+				++dropped_;
+				continue;
+			}
+			indices_[slot] = index;
+			stamps_[slot] = stamp;
+			if (policy_ == DropPolicy::latestOnly)
+			{
+				dropped_ += static_cast<std::int64_t>(ready_.size());
+				free_.insert(free_.end(), ready_.begin(), ready_.end());
+				ready_.clear();
+			}
+			ready_.push_back(slot);
+			maxDepth_ = std::max(maxDepth_, static_cast<int>(ready_.size()));
+			frameReady_.notify_one();
+		}
+
+		std::lock_guard<std::mutex> lock{ mutex_ };
+		finished_ = true;
+		frameReady_.notify_all();
+	}
+
+	void release(int slot)
+	{
+		std::lock_guard<std::mutex> lock{ mutex_ };
+		free_.push_back(slot);
+		slotFree_.notify_one();
+	}
+
+	cv::VideoCapture cap_;
+	std::vector<cv::Mat> slots_;
+	std::vector<std::int64_t> indices_;
+	std::vector<std::chrono::steady_clock::time_point> stamps_;
+	cv::Mat discard_;
+	DropPolicy policy_;
+
+	mutable std::mutex mutex_;
+	std::condition_variable frameReady_, slotFree_;
+	std::deque<int> ready_;
+	std::vector<int> free_;
+	bool stopping_{ false }, finished_{ false };
+	int maxDepth_{ 0 };
+	std::int64_t decoded_{ 0 }, dropped_{ 0 };
+
+	std::thread thread_;
+};
+
+inline void CapturedFrame::release()
+{
+	if (owner_)
+		owner_->release(slot_);
+	owner_ = nullptr;
+	slot_ = -1;
+	image_.release();
+}
@@ -0,0 +1,96 @@
+/*
+ * One affine or perspective transform applied to many images of the same size.
+ *
+ * warpAffine() and warpPerspective() work out, for every output pixel, where in the source image it comes from, on
+ * every call. When thousands of frames of one size get the same transform, those positions are the same every time.
+ * TransformEngine works them out once, when it's created, in the fixed-point format of remap(): a CV_16SC2 map with
+ * the whole source coordinates and a CV_16UC1 map with an index into remap()'s table of interpolation weights
+ * (1/32 pixel steps, the same precision warpAffine() uses, see convertMaps()). Each image then only costs a remap(),
+ * whose inner loop loads the source pixels at the precomputed positions with SIMD.
+ *
+ * apply() with a batch of images gives each core whole images: one remap() per image in cv::parallel_for_(), so the
+ * cores never share an image and never wait on each other. The result matches warpAffine() / warpPerspective() with
+ * the same arguments to within one gray level from rounding.
+ *
+ * The matrix is a 2x3 affine matrix (05b: getRotationMatrix2D()) or a 3x3 perspective matrix (07:
+ * getPerspectiveTransform()), from source to output unless flags contain WARP_INVERSE_MAP, like for the OpenCV
+ * functions. INTER_NEAREST, INTER_LINEAR, INTER_CUBIC and INTER_LANCZOS4 are supported.
+ */
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+class TransformEngine
+{
+public:
+	TransformEngine(const cv::Mat& matrix, cv::Size srcSize, cv::Size dstSize, int flags = cv::INTER_LINEAR,
+		int borderMode = cv::BORDER_CONSTANT, const cv::Scalar& borderValue = cv::Scalar())
+		: srcSize_{ srcSize }, dstSize_{ dstSize }, interpolation_{ flags & cv::INTER_MAX },
+		borderMode_{ borderMode }, borderValue_{ borderValue }
+	{
+		CV_Assert((matrix.rows == 2 || matrix.rows == 3) && matrix.cols == 3);
+		CV_Assert(interpolation_ != cv::INTER_AREA && interpolation_ != cv::INTER_LINEAR_EXACT);
+		buildMaps(matrix, flags & cv::WARP_INVERSE_MAP);
+	}
+
+	// Transforms one image, which must have the source size given to the constructor.
+	void apply(const cv::Mat& src, cv::Mat& dst) const
+	{
+		CV_Assert(src.size() == srcSize_);
+		cv::remap(src, dst, map1_, map2_, interpolation_, borderMode_, borderValue_);
+	}
+
+	// Transforms every image of srcs into dsts, one image per core at a time.
+	void apply(const std::vector<cv::Mat>& srcs, std::vector<cv::Mat>& dsts) const
+	{
+		dsts.resize(srcs.size());
+		cv::parallel_for_(cv::Range(0, static_cast<int>(srcs.size())), [&](const cv::Range& range)
+			{
+				for (int i{ range.start }; i < range.end; ++i)
+					apply(srcs[i], dsts[i]);
+			});
+	}
+
+	cv::Size srcSize() const { return srcSize_; }
+	cv::Size dstSize() const { return dstSize_; }
+	// Memory taken by the maps.
+	std::size_t bytes() const { return map1_.total() * map1_.elemSize() + map2_.total() * map2_.elemSize(); }
+
+private:
+	void buildMaps(const cv::Mat& matrix, bool inverseGiven)
+	{
+		// The inverse transform maps every output pixel back to its place in the source image.
+		cv::Mat m(3, 3, CV_64F, cv::Scalar(0));
+		m.at<double>(2, 2) = 1.0;
+		cv::Mat given{ m.rowRange(0, matrix.rows) };
+		matrix.convertTo(given, CV_64F);
+		if (!inverseGiven)
+			m = m.inv();
+		const double* t{ m.ptr<double>() };
+
+		cv::Mat mapXY(dstSize_, CV_32FC2);
+		cv::parallel_for_(cv::Range(0, dstSize_.height), [&](const cv::Range& range)
+			{
+				for (int y{ range.start }; y < range.end; ++y)
+				{
+					cv::Vec2f* row{ mapXY.ptr<cv::Vec2f>(y) };
+					for (int x{ 0 }; x < dstSize_.width; ++x)
+					{
+						double z{ t[6] * x + t[7] * y + t[8] };
+						z = z != 0.0 ? 1.0 / z : 0.0;
+						row[x][0] = static_cast<float>((t[0] * x + t[1] * y + t[2]) * z);
+						row[x][1] = static_cast<float>((t[3] * x + t[4] * y + t[5]) * z);
+					}
+				}
+			});
+		// Nearest neighbor needs only the whole coordinates, the other methods also the weights index.
+		cv::convertMaps(mapXY, cv::Mat(), map1_, map2_, CV_16SC2, interpolation_ == cv::INTER_NEAREST);
+	}
+
+	cv::Size srcSize_, dstSize_;
+	int interpolation_;
+	int borderMode_;
+	cv::Scalar borderValue_;
+	cv::Mat map1_, map2_;
+};
@@ -0,0 +1,162 @@
+/*
+ * Cache of remap tables for perspective warps whose quad hardly changes.
+ *
+ * warpPerspective() works out, for every output pixel, where in the source image that pixel comes from, and it does
+ * so on every call. With a fixed camera the document quad is almost always the same, so the same mapping is worked
+ * out over and over. WarpCache computes the mapping once per quad, converts it to the fixed-point format of remap()
+ * (a CV_16SC2 map with integer coordinates plus a CV_16UC1 map with the interpolation weights, see convertMaps())
+ * and reuses it for every following warp of a quad within tolerance.
+ *
+ * Entries are keyed by the quad corners rounded to a grid of `tolerance` pixels and by the output size. Two quads
+ * in the same grid cell differ by less than `tolerance` pixels in every corner, and are warped with the same maps.
+ * The cache holds at most `maxBytes` of maps and drops the least recently used entry when it's full.
+ *
+ * The quad is given in the corner order the lessons use: top-left, top-right, bottom-left, bottom-right, mapped to
+ * (0, 0), (w, 0), (0, h), (w, h) of the output. The cache can be shared between threads.
+ */
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+class WarpCache
+{
+public:
+	explicit WarpCache(std::size_t maxBytes = 64u << 20, float tolerance = 2.0f)
+		: maxBytes_{ maxBytes }, tolerance_{ tolerance > 0 ? tolerance : 1.0f } {}
+
+	WarpCache(const WarpCache&) = delete;
+	WarpCache& operator=(const WarpCache&) = delete;
+
+	// Warps `quad` of img to an image of `size`. Same result as getPerspectiveTransform + warpPerspective with
+	// linear interpolation.
+	void warp(const cv::Mat& img, const cv::Point2f quad[4], cv::Size size, cv::Mat& dst)
+	{
+		std::shared_ptr<const Entry> entry{ find(quad, size) };
+		cv::remap(img, dst, entry->map1, entry->map2, cv::INTER_LINEAR);
+	}
+
+	std::int64_t hits() const { std::lock_guard<std::mutex> lock{ mutex_ }; return hits_; }
+	std::int64_t misses() const { std::lock_guard<std::mutex> lock{ mutex_ }; return misses_; }
+	std::int64_t evictions() const { std::lock_guard<std::mutex> lock{ mutex_ }; return evictions_; }
+	std::size_t bytes() const { std::lock_guard<std::mutex> lock{ mutex_ }; return bytes_; }
+	std::size_t entries() const { std::lock_guard<std::mutex> lock{ mutex_ }; return lru_.size(); }
+
+private:
+	struct Key
+	{
+		std::array<int, 8> corners;
+		int width, height;
+
+		bool operator==(const Key& other) const
+		{
+			return corners == other.corners && width == other.width && height == other.height;
+		}
+	};
+
+	struct KeyHash
+	{
+		std::size_t operator()(const Key& key) const
+		{
+			std::size_t seed{ std::hash<int>{}(key.width) * 31 + std::hash<int>{}(key.height) };
+			for (int c : key.corners)
+				seed ^= std::hash<int>{}(c) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+			return seed;
+		}
+	};
+
+	struct Entry
+	{
+		Key key;
+		cv::Mat map1, map2;
+		std::size_t bytes;
+	};
+
+	using Lru = std::list<std::shared_ptr<const Entry>>;
+
+	std::shared_ptr<const Entry> find(const cv::Point2f quad[4], cv::Size size)
+	{
+		Key key{ {}, size.width, size.height };
+		for (int i{ 0 }; i < 4; ++i)
+		{
+			key.corners[2 * i] = static_cast<int>(std::floor(quad[i].x / tolerance_));
+			key.corners[2 * i + 1] = static_cast<int>(std::floor(quad[i].y / tolerance_));
+		}
+
+		{
+			std::lock_guard<std::mutex> lock{ mutex_ };
+			auto it{ index_.find(key) };
+			if (it != index_.end())
+			{
+				// Move the entry to the front of the LRU list.
+				lru_.splice(lru_.begin(), lru_, it->second);
+				++hits_;
+				return *it->second;
+			}
+			++misses_;
+		}
+
+		// Build the maps without holding the lock, other threads can keep warping in the meantime.
+		std::shared_ptr<const Entry> entry{ build(key, quad, size) };
+
+		std::lock_guard<std::mutex> lock{ mutex_ };
+		if (entry->bytes > maxBytes_ || index_.count(key) > 0)
+			return entry;
+		while (!lru_.empty() && bytes_ + entry->bytes > maxBytes_)
+		{
+			bytes_ -= lru_.back()->bytes;
+			index_.erase(lru_.back()->key);
+			lru_.pop_back();
+			++evictions_;
+		}
+		lru_.push_front(entry);
+		index_[key] = lru_.begin();
+		bytes_ += entry->bytes;
+		return entry;
+	}
+
+	static std::shared_ptr<const Entry> build(const Key& key, const cv::Point2f quad[4], cv::Size size)
+	{
+		// The inverse transform maps every output pixel back to its place in the source image.
+		float w{ static_cast<float>(size.width) }, h{ static_cast<float>(size.height) };
+		cv::Point2f corners[4]{ { 0.0f, 0.0f }, { w, 0.0f }, { 0.0f, h }, { w, h } };
+		cv::Mat inverse{ cv::getPerspectiveTransform(corners, quad) };
+		const double* m{ inverse.ptr<double>() };
+
+		cv::Mat mapXY(size, CV_32FC2);
+		for (int y{ 0 }; y < size.height; ++y)
+		{
+			cv::Vec2f* row{ mapXY.ptr<cv::Vec2f>(y) };
+			for (int x{ 0 }; x < size.width; ++x)
+			{
+				double z{ m[6] * x + m[7] * y + m[8] };
+				z = z != 0.0 ? 1.0 / z : 0.0;
+				row[x][0] = static_cast<float>((m[0] * x + m[1] * y + m[2]) * z);
+				row[x][1] = static_cast<float>((m[3] * x + m[4] * y + m[5]) * z);
+			}
+		}
+
+		auto entry{ std::make_shared<Entry>() };
+		entry->key = key;
+		cv::convertMaps(mapXY, cv::Mat(), entry->map1, entry->map2, CV_16SC2);
+		entry->bytes = entry->map1.total() * entry->map1.elemSize() + entry->map2.total() * entry->map2.elemSize();
+		return entry;
+	}
+
+	std::size_t maxBytes_;
+	float tolerance_;
+
+	mutable std::mutex mutex_;
+	Lru lru_;
+	std::unordered_map<Key, Lru::iterator, KeyHash> index_;
+	std::size_t bytes_{ 0 };
+	std::int64_t hits_{ 0 }, misses_{ 0 }, evictions_{ 0 };
+};